@@ -0,0 +1,436 @@
+/* Batch mode. Runs many programs, each on its own simulated computer,
+ * in a pool of threads, and reports the result of each run as a line
+ * of JSON on standard output.
+ *
+ * The jobs are listed in a manifest file, one per line, as three
+ * whitespace-separated file names:
+ *
+ * <program.b91> <input> <expected-output>
+ *
+ * where the program may also be an image (see image.c).
+ *
+ * The program reads its IN instructions and READ supervisor calls from
+ * the input file, and passes if everything it writes (the "Input:"
+ * prompts, the "Output:" lines and the final "HALT") is byte for byte
+ * the same as the expected output file, i.e. what ckone prints to
+ * standard output when run on the program with the input file as
+ * standard input. Blank lines and lines starting with # are ignored.
+ *
+ * Each distinct program is parsed only once, before any thread is
+ * started; every job then gets a fresh copy of its memory. Errors in
+ * a job, including those in its program file, only fail that job.
+ * The resource limits given on the command line apply to every job.
+ *
+ * With more than one lane, a thread takes up to that many consecutive
+ * jobs of the manifest that run the same program and runs them
+ * together on the lockstep engine (see lockstep.c), so a program
+ * should be listed with all of its inputs one after the other. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "image.h"
+#include "sim.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "batch.h"
+
+/* Maximum length of a manifest line in characters */
+#define MAXLINELEN 4095
+
+/* A program as loaded from its .b91 file */
+struct prog
+{
+    char *file; /* name of the .b91 file */
+    struct machine m; /* the computer after loading, before running */
+    char *error; /* why the file couldn't be loaded, or a null pointer */
+};
+
+/* A line of the manifest */
+struct job
+{
+    struct prog *prog;
+    char *input; /* name of the file to use as standard input */
+    char *expect; /* name of the file holding the expected output */
+};
+
+/* One run of a job. Holds everything the run allocates, so that it
+ * can be cleaned up even if the run dies. */
+struct run
+{
+    struct job *job;
+    struct machine m;
+    char *out; /* the program's output */
+    size_t outlen;
+    char *expect; /* the contents of the expected output file */
+    size_t expectlen;
+};
+
+/* The jobs and programs of the manifest */
+static struct job *jobs;
+static size_t njob;
+static struct prog *progs;
+static size_t nprog;
+
+/* Protects the variables below, which the threads share */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Index of the next job to hand out to a thread */
+static size_t nextjob;
+
+/* Most jobs a thread runs in lockstep at once */
+static size_t nlane;
+
+/* Nonzero if some job has not passed */
+static int failed;
+
+/*
+ * Loading the manifest
+ */
+
+/*
+ * findprog -- find or add a program by file name
+ *
+ * file -- the name of the .b91 file
+ * return value -- the index of the program in progs
+ */
+static size_t findprog(char *file)
+{
+    size_t i;
+
+    for(i=0; i<nprog; i++)
+        if(!strcmp(progs[i].file, file)) return(i);
+    if(!(progs = realloc(progs, (nprog+1)*sizeof(*progs)))) die("out of memory");
+    if(!(progs[nprog].file = strdup(file))) die("out of memory");
+    return(nprog++);
+}
+
+/*
+ * readmanifest -- read the jobs from the manifest file
+ *
+ * manifest -- the name of the manifest file
+ *
+ * Programs are identified by index while reading, since the progs
+ * array moves as it grows; the job's pointers are patched at the end.
+ */
+static void readmanifest(char *manifest)
+{
+    char line[MAXLINELEN+2];
+    char *words[3];
+    size_t *progidx;
+    size_t i, lineno;
+    FILE *f;
+
+    if(!(f = fopen(manifest, "r"))) dies("cannot open manifest", manifest);
+    progidx = 0;
+    for(lineno=1; fgets(line, sizeof(line), f); lineno++)
+    {
+        if(!strchr(line, '\n') && !feof(f)) die("manifest line too long");
+        if(!(words[0] = strtok(line, " \t\r\n")) || (words[0][0] == '#')) continue;
+        words[1] = strtok(0, " \t\r\n");
+        words[2] = words[1] ? strtok(0, " \t\r\n") : 0;
+        if(!words[2] || strtok(0, " \t\r\n"))
+        {
+            fprintf(stderr, "%s:%zu: ", manifest, lineno);
+            die("expected <program> <input> <expected-output>");
+        }
+        if(!(jobs = realloc(jobs, (njob+1)*sizeof(*jobs)))) die("out of memory");
+        if(!(progidx = realloc(progidx, (njob+1)*sizeof(*progidx)))) die("out of memory");
+        progidx[njob] = findprog(words[0]);
+        if(!(jobs[njob].input = strdup(words[1]))) die("out of memory");
+        if(!(jobs[njob].expect = strdup(words[2]))) die("out of memory");
+        njob++;
+    }
+    if(ferror(f)) die("cannot read from manifest");
+    fclose(f);
+    for(i=0; i<njob; i++) jobs[i].prog = &progs[progidx[i]];
+    free(progidx);
+}
+
+/*
+ * loadprog -- load a program into its computer. Called through
+ * catchdie().
+ *
+ * arg -- the program
+ */
+static void loadprog(void *arg)
+{
+    struct prog *prog = arg;
+
+    loadfile(&prog->m, prog->file);
+}
+
+/*
+ * Running jobs
+ */
+
+/*
+ * readfile -- read a whole file into memory
+ *
+ * file -- the name of the file
+ * out_buf -- pointer to output parameter into which a pointer to the
+ * malloc'ed contents is stored
+ * out_len -- pointer to output parameter into which the length of the
+ * contents in bytes is stored
+ */
+static void readfile(char *file, char **out_buf, size_t *out_len)
+{
+    FILE *f;
+    size_t n;
+
+    if(!(f = fopen(file, "rb"))) dies("cannot open expected output", file);
+    for(;;)
+    {
+        if(!(*out_buf = realloc(*out_buf, *out_len + BUFSIZ))) die("out of memory");
+        n = fread(*out_buf + *out_len, 1, BUFSIZ, f);
+        *out_len += n;
+        if(n < BUFSIZ) break;
+    }
+    n = ferror(f);
+    fclose(f);
+    if(n) dies("cannot read expected output", file);
+}
+
+/*
+ * setupjob -- set up a computer for a job. Called through catchdie().
+ *
+ * arg -- the run
+ */
+static void setupjob(void *arg)
+{
+    struct run *r = arg;
+    struct machine *m = &r->m, *t = &r->job->prog->m;
+
+    readfile(r->job->expect, &r->expect, &r->expectlen);
+    copymachine(m, t);
+    if(!(m->in = fopen(r->job->input, "r"))) dies("cannot open input file", r->job->input);
+    if(!(m->out = open_memstream(&r->out, &r->outlen))) die("out of memory");
+}
+
+/*
+ * runjob -- set up a computer for a job and run it. Called through
+ * catchdie().
+ *
+ * arg -- the run
+ */
+static void runjob(void *arg)
+{
+    struct run *r = arg;
+
+    setupjob(r);
+    simulate(&r->m);
+}
+
+/*
+ * putjson -- write a string as a JSON string literal
+ *
+ * f -- the output stream
+ * s -- the string
+ */
+void putjson(FILE *f, char *s)
+{
+    putc('"', f);
+    for(; *s; s++)
+    {
+        if((*s == '"') || (*s == '\\')) fprintf(f, "\\%c", *s);
+        else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else putc(*s, f);
+    }
+    putc('"', f);
+}
+
+/*
+ * report -- write the result of a job to standard output
+ *
+ * i -- the index of the job
+ * status -- "pass", "fail", "error", or "limit" for an error-exit
+ * caused by a resource limit
+ * error -- the error message for status "error", or a null pointer
+ *
+ * The caller holds the lock.
+ */
+static void report(size_t i, char *status, char *error)
+{
+    printf("{\"job\":%zu,\"program\":", i+1);
+    putjson(stdout, jobs[i].prog->file);
+    printf(",\"input\":");
+    putjson(stdout, jobs[i].input);
+    printf(",\"status\":\"%s\"", status);
+    if(error)
+    {
+        printf(",\"error\":");
+        putjson(stdout, error);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+/*
+ * startjob -- get ready to run a job
+ *
+ * r -- the run
+ * i -- the index of the job
+ */
+static void startjob(struct run *r, size_t i)
+{
+    memset(r, 0, sizeof(*r));
+    r->job = &jobs[i];
+    initmachine(&r->m);
+    r->m.in = r->m.out = 0;
+}
+
+/*
+ * endjob -- report the result of a job and clean up after it
+ *
+ * r -- the run
+ * i -- the index of the job
+ * error -- the message of the error-exit that ended the run, or a null
+ * pointer if the program halted
+ * limited -- nonzero if the error-exit was caused by a resource limit
+ */
+static void endjob(struct run *r, size_t i, char *error, int limited)
+{
+    char *status;
+
+    if(r->m.in) fclose(r->m.in);
+    if(r->m.out) fclose(r->m.out);
+    if(limited) status = "limit";
+    else if(error) status = "error";
+    else if((r->outlen == r->expectlen) && !memcmp(r->out, r->expect, r->outlen)) status = "pass";
+    else status = "fail";
+
+    pthread_mutex_lock(&lock);
+    report(i, status, error);
+    if(strcmp(status, "pass")) failed = 1;
+    pthread_mutex_unlock(&lock);
+
+    freemachine(&r->m);
+    free(r->out);
+    free(r->expect);
+}
+
+/*
+ * runlanes -- run consecutive jobs of the same program in lockstep
+ *
+ * runs -- room for a run per job
+ * first -- the index of the first job
+ * n -- how many jobs, at most MAXLANES
+ */
+static void runlanes(struct run *runs, size_t first, size_t n)
+{
+    struct lane lanes[MAXLANES];
+    size_t which[MAXLANES];
+    size_t i, nl;
+    char *error;
+    int limited;
+
+    nl = 0;
+    for(i=0; i<n; i++)
+    {
+        startjob(&runs[i], first+i);
+        limited = 0;
+        if(!(error = runs[i].job->prog->error))
+            if((error = catchdie(setupjob, &runs[i]))) limited = (caughtstatus() == LIMITSTATUS);
+        if(error)
+        {
+            endjob(&runs[i], first+i, error, limited);
+            continue;
+        }
+        lanes[nl].m = &runs[i].m;
+        which[nl++] = i;
+    }
+    simulate_lockstep(lanes, nl);
+    for(i=0; i<nl; i++)
+        endjob(&runs[which[i]], first+which[i], lanes[i].status ? lanes[i].error : 0,
+               lanes[i].status == LIMITSTATUS);
+}
+
+/*
+ * worker -- thread that runs jobs until there are none left
+ *
+ * arg -- unused
+ * return value -- a null pointer
+ */
+static void *worker(void *arg)
+{
+    struct run runs[MAXLANES];
+    char *error;
+    int limited;
+    size_t i, n;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&lock);
+        i = nextjob;
+        for(n=0; (nextjob < njob) && (n < nlane) && (jobs[nextjob].prog == jobs[i].prog); n++) nextjob++;
+        pthread_mutex_unlock(&lock);
+        if(!n) break;
+        if(n > 1)
+        {
+            runlanes(runs, i, n);
+            continue;
+        }
+
+        startjob(&runs[0], i);
+        limited = 0;
+        if(!(error = runs[0].job->prog->error))
+            if((error = catchdie(runjob, &runs[0]))) limited = (caughtstatus() == LIMITSTATUS);
+        endjob(&runs[0], i, error, limited);
+    }
+    jit_release();
+    return(0);
+}
+
+/*
+ * batch -- run the jobs of a manifest
+ *
+ * manifest -- the name of the manifest file
+ * nthread -- how many threads to run jobs in, or zero for one per
+ * online processor
+ * lanes -- how many jobs of the same program a thread may run in
+ * lockstep at once, up to MAXLANES; zero or one to run every job by
+ * itself
+ * return value -- the exit status for ckone: zero if every job passed,
+ * one otherwise
+ */
+int batch(char *manifest, int nthread, int lanes)
+{
+    pthread_t *threads;
+    char *error;
+    size_t i;
+    int n;
+
+    readmanifest(manifest);
+    nlane = lanes > 1 ? lanes : 1;
+    if(nlane > MAXLANES) nlane = MAXLANES;
+    for(i=0; i<nprog; i++)
+    {
+        initmachine(&progs[i].m);
+        if((error = catchdie(loadprog, &progs[i])))
+            if(!(progs[i].error = strdup(error))) die("out of memory");
+    }
+
+    if(nthread <= 0)
+    {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = n > 0 ? n : 1;
+    }
+    if((size_t)nthread > njob) nthread = njob ? njob : 1;
+    if(!(threads = calloc(nthread, sizeof(*threads)))) die("out of memory");
+    for(n=0; n<nthread; n++)
+        if(pthread_create(&threads[n], 0, worker, 0)) die("cannot create thread");
+    for(n=0; n<nthread; n++)
+        pthread_join(threads[n], 0);
+    free(threads);
+    return(failed);
+}
@@ -0,0 +1,6 @@
+/* Batch mode. Runs many programs, each on its own simulated computer,
+ * in a pool of threads, and reports the result of each run as a line
+ * of JSON on standard output. */
+
+int batch(char *manifest, int nthread, int lanes);
+void putjson(FILE *f, char *s);
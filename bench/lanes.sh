@@ -0,0 +1,38 @@
+#!/bin/sh
+# Lockstep engine benchmark. Runs bench/lanes.b91 (or another program
+# reading one number) on many inputs in batch mode with one thread,
+# once with each engine running every job by itself and once with
+# --lanes 16, and reports the jobs per second of each.
+#
+# usage: bench/lanes.sh [jobs [program]]
+#
+# Timing relies on the %N format of GNU date.
+
+jobs=${1:-256}
+program=${2:-bench/lanes.b91}
+ckone=${CKONE:-./ckone}
+dir=${TMPDIR:-/tmp}/ckone-lanes-bench.$$
+
+trap 'rm -rf "$dir"' EXIT INT TERM
+mkdir "$dir" || exit 1
+
+# The expected output of every input, from ckone itself
+i=0
+while [ $i -lt "$jobs" ]; do
+    echo $((i * 7919 % 100003)) > "$dir/in$i"
+    "$ckone" --engine jit "$program" < "$dir/in$i" > "$dir/out$i" || exit 1
+    echo "$program $dir/in$i $dir/out$i" >> "$dir/manifest"
+    i=$((i + 1))
+done
+
+bench() {
+    start=$(date +%s%N)
+    "$ckone" --threads 1 "$@" --batch "$dir/manifest" > "$dir/report" || exit 1
+    end=$(date +%s%N)
+    echo "$*: $jobs jobs in $(((end - start) / 1000000)) ms, $((jobs * 1000000000 / (end - start))) jobs/s"
+}
+
+for e in switch threaded jit; do
+    bench --engine $e
+done
+bench --lanes 16
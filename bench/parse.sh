@@ -0,0 +1,49 @@
+#!/bin/sh
+# Parser throughput benchmark. Generates a synthetic .b91 file of
+# several megabytes, times how long ckone takes to load it (the
+# program halts at its first instruction) and reports the throughput
+# in MB/s. Exits with failure if the best of the runs is slower than
+# the target, so that it can be used to catch regressions.
+#
+# usage: bench/parse.sh [words [target-MB/s [runs]]]
+#
+# Timing relies on the %N format of GNU date.
+
+words=${1:-1000000}
+target=${2:-100}
+runs=${3:-5}
+ckone=${CKONE:-./ckone}
+file=${TMPDIR:-/tmp}/ckone-parse-bench.$$.b91
+
+trap 'rm -f "$file"' EXIT INT TERM
+
+# A code area holding SVC SP, =HALT, and a data area of large positive
+# and negative words, with a symbol for every 1000th word
+awk -v n="$words" 'BEGIN {
+    print "___b91___"
+    print "___code___"
+    print "0 0"
+    print 1891631115
+    print "___data___"
+    print 1, n
+    for(i = 0; i < n; i++) printf "%d\n", (i % 2 ? -1 : 1) * (i * 7919 % 1000000007) * 1000003
+    print "___symboltable___"
+    for(i = 0; i < n; i += 1000) print "sym" i, i+1
+    print "___end___"
+}' > "$file"
+bytes=$(wc -c < "$file")
+
+best=
+i=0
+while [ $i -lt "$runs" ]; do
+    start=$(date +%s%N)
+    "$ckone" "$file" > /dev/null || exit 1
+    end=$(date +%s%N)
+    ns=$((end - start))
+    if [ -z "$best" ] || [ $ns -lt $best ]; then best=$ns; fi
+    i=$((i + 1))
+done
+
+mbs=$((bytes * 1000 / best))
+echo "parse: $bytes bytes in $((best / 1000000)) ms, $mbs MB/s (target $target MB/s)"
+[ $mbs -ge "$target" ]
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Server mode throughput benchmark. Runs examples/fact.b91 on many
+# inputs, once through ckone --server and once starting ckone for every
+# input, and reports the runs per second of each.
+#
+# usage: bench/server.sh [runs [program]]
+#
+# Timing relies on the %N format of GNU date.
+
+runs=${1:-10000}
+program=${2:-examples/fact.b91}
+ckone=${CKONE:-./ckone}
+requests=${TMPDIR:-/tmp}/ckone-server-bench.$$
+
+trap 'rm -f "$requests"' EXIT INT TERM
+
+awk -v n="$runs" 'BEGIN { for(i = 0; i < n; i++) print i % 12 + 1 }' > "$requests"
+
+start=$(date +%s%N)
+"$ckone" --server "$program" < "$requests" > /dev/null || exit 1
+end=$(date +%s%N)
+echo "server: $runs runs in $(((end - start) / 1000000)) ms, $((runs * 1000000000 / (end - start))) runs/s"
+
+# Starting a process per run is much slower, so do a tenth as many
+n=$((runs / 10))
+start=$(date +%s%N)
+head -n "$n" "$requests" | while read -r input; do
+    echo "$input" | "$ckone" "$program" > /dev/null
+done
+end=$(date +%s%N)
+echo "process per run: $n runs in $(((end - start) / 1000000)) ms, $((n * 1000000000 / (end - start))) runs/s"
@@ -0,0 +1,194 @@
+/* Simulator benchmark harness. Loads each of the given .b91 files with
+ * parsefile() and runs it with simulate() on one engine, the way ckone
+ * would, and prints a line of JSON per file:
+ *
+ * {"workload":"...","engine":"...","wordbits":W,"insns":N,
+ *  "seconds":S,"insns_per_s":I,"ns_per_insn":T,"parse_mb_per_s":P,
+ *  "maxrss_kb":R,"output":"..."}
+ *
+ * where S is the best of the runs, P is the throughput of parsefile()
+ * on the file, R is the peak resident set size of the process so far,
+ * and the output is what the program wrote, so that runs on different
+ * engines can be checked against each other. The workloads are meant to
+ * be the ones in bench/workloads; "make bench" runs them on every
+ * engine, each engine in a process of its own so that the peak RSS is
+ * that of one engine.
+ *
+ * usage: bench/simbench [-e switch|threaded|jit] [-r runs] file.b91... */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../die.h"
+#include "../word.h"
+#include "../machine.h"
+#include "../mem.h"
+#include "../parser.h"
+#include "../sim.h"
+#include "../batch.h"
+
+/* The values the simulator takes from ckone's command line options,
+ * see ckone.c. All are left at their defaults except the engine. */
+int verbose;
+int engine = ENGINE_SWITCH;
+int fuse = 1;
+int interactive;
+int deterministic;
+char *profilefile;
+size_t maxinsns;
+double timeout;
+size_t maxmem = MEMRESERVE;
+char *snapfile;
+size_t snappc = SIZE_MAX;
+size_t snapinsns = SIZE_MAX;
+
+/* Engine names, indexed by the ENGINE_* constants */
+static char *engines[] = {"switch", "threaded", "jit"};
+
+/* How long in seconds to keep parsing a file to time parsefile() */
+#define PARSETIME 0.2
+
+/*
+ * now -- the time in seconds from an arbitrary starting point
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec/1e9);
+}
+
+/*
+ * usage -- print instructions on command line usage and exit
+ */
+static void usage(void)
+{
+    fprintf(stderr, "usage: simbench [-e switch|threaded|jit] [-r runs] file.b91...\n");
+    exit(1);
+}
+
+/*
+ * parserate -- time parsefile() on a file
+ *
+ * file -- the name of the .b91 file
+ * return value -- the throughput in megabytes per second
+ */
+static double parserate(char *file)
+{
+    struct machine m;
+    double start, elapsed;
+    size_t n;
+    long bytes;
+    FILE *f;
+
+    if(!(f = fopen(file, "rb"))) dies("cannot open input file", file);
+    if(fseek(f, 0, SEEK_END)) dies("cannot read input file", file);
+    if((bytes = ftell(f)) < 0) dies("cannot read input file", file);
+    fclose(f);
+
+    start = now();
+    n = 0;
+    do
+    {
+        initmachine(&m);
+        parsefile(&m, file);
+        freemachine(&m);
+        n++;
+    }
+    while((elapsed = now()-start) < PARSETIME);
+    return(bytes*(double)n/elapsed/1e6);
+}
+
+/*
+ * run -- load a program and run it once
+ *
+ * file -- the name of the .b91 file
+ * out_insns -- where to store the count of instructions executed
+ * out_output -- where to store what the program wrote, which the
+ * caller must free
+ * return value -- the time in seconds simulate() took
+ */
+static double run(char *file, size_t *out_insns, char **out_output)
+{
+    struct machine m;
+    double start, elapsed;
+    size_t len;
+
+    initmachine(&m);
+    parsefile(&m, file);
+    if(!(m.in = fopen("/dev/null", "r"))) die("cannot open /dev/null");
+    if(!(m.out = open_memstream(out_output, &len))) die("out of memory");
+    start = now();
+    simulate(&m);
+    elapsed = now()-start;
+    *out_insns = m.retired;
+    fclose(m.in);
+    fclose(m.out);
+    freemachine(&m);
+    return(elapsed);
+}
+
+/*
+ * bench -- benchmark one workload and print its line of JSON
+ *
+ * file -- the name of the .b91 file
+ * runs -- how many times to run it
+ */
+static void bench(char *file, int runs)
+{
+    struct rusage ru;
+    double best, secs, mbs;
+    size_t insns;
+    char *output, *name;
+    int i;
+
+    mbs = parserate(file);
+    best = run(file, &insns, &output);
+    for(i=1; i<runs; i++)
+    {
+        free(output);
+        if((secs = run(file, &insns, &output)) < best) best = secs;
+    }
+    getrusage(RUSAGE_SELF, &ru);
+
+    name = strrchr(file, '/') ? strrchr(file, '/')+1 : file;
+    printf("{\"workload\":");
+    putjson(stdout, name);
+    printf(",\"engine\":\"%s\",\"wordbits\":%d,\"insns\":%zu,\"seconds\":%.6f",
+           engines[engine], WORDBITS, insns, best);
+    printf(",\"insns_per_s\":%.0f,\"ns_per_insn\":%.3f,\"parse_mb_per_s\":%.1f,\"maxrss_kb\":%ld",
+           insns/best, best*1e9/(insns ? insns : 1), mbs, ru.ru_maxrss);
+    printf(",\"output\":");
+    putjson(stdout, output);
+    printf("}\n");
+    fflush(stdout);
+    free(output);
+}
+
+int main(int argc, char **argv)
+{
+    int i, e, runs = 3;
+
+    for(i=1; (i < argc) && (argv[i][0] == '-'); i++)
+    {
+        if(!strcmp(argv[i], "-r") && (i+1 < argc)) runs = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-e") && (i+1 < argc))
+        {
+            for(e=0, i++; (e < 3) && strcmp(argv[i], engines[e]); e++);
+            if(e == 3) usage();
+            engine = e;
+        }
+        else usage();
+    }
+    if((i == argc) || (runs < 1)) usage();
+    for(; i<argc; i++) bench(argv[i], runs);
+    return(0);
+}
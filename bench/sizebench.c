@@ -0,0 +1,83 @@
+/* Microbenchmark of the checked arithmetic in size.c. Times each
+ * operation over a range of operands and prints the cost per call in
+ * nanoseconds. The repeated-addition multiplication that size_mul()
+ * used to be is included for comparison, since its cost grew with the
+ * smaller operand. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../size.h"
+
+/* Calls per measurement */
+#define CALLS 10000000
+
+/* Keeps the compiler from optimizing the calls away */
+static volatile size_t sink;
+
+/*
+ * oldmul -- the former size_mul(), which added x to itself n times
+ */
+static size_t oldmul(size_t x, size_t n)
+{
+    size_t c = 0;
+    for(; n; n--) c = size_add(c, x);
+    return(c);
+}
+
+/*
+ * now -- the time in nanoseconds from an arbitrary starting point
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec*1e9 + ts.tv_nsec);
+}
+
+/*
+ * report -- print the cost of a measurement
+ *
+ * name -- what was measured
+ * start -- now() before the calls
+ * calls -- how many calls were made
+ */
+static void report(char *name, double start, size_t calls)
+{
+    printf("%-24s %8.2f ns/call\n", name, (now()-start)/calls);
+}
+
+int main(void)
+{
+    static const size_t ns[] = {1, 10, 16, 100, 1000};
+    char name[64];
+    double start;
+    size_t i, k, acc;
+
+    for(k=0; k<sizeof(ns)/sizeof(ns[0]); k++)
+    {
+        start = now();
+        for(i=0, acc=0; i<CALLS/ns[k]; i++) acc += oldmul(i, ns[k]);
+        sink = acc;
+        sprintf(name, "old size_mul(x, %zu)", ns[k]);
+        report(name, start, CALLS/ns[k]);
+
+        start = now();
+        for(i=0, acc=0; i<CALLS; i++) acc += size_mul(i, ns[k]);
+        sink = acc;
+        sprintf(name, "size_mul(x, %zu)", ns[k]);
+        report(name, start, CALLS);
+    }
+
+    start = now();
+    for(i=0, acc=0; i<CALLS; i++) acc += size_add(i, acc & 0xffff);
+    sink = acc;
+    report("size_add", start, CALLS);
+    return(0);
+}
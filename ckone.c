@@ -2,16 +2,28 @@
  * other modules of the program in the right sequence. Some modules
  * are only called in verbose mode. */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "die.h"
-#include "parser.h"
+#include "word.h"
+#include "machine.h"
+#include "image.h"
 #include "mem.h"
 #include "sym.h"
 #include "disasm.h"
+#include "trace.h"
+#include "io.h"
+#include "dev.h"
+#include "iolog.h"
+#include "snap.h"
 #include "sim.h"
+#include "threaded.h"
+#include "batch.h"
+#include "server.h"
 
 /*
  * Values from command line arguments
@@ -22,9 +34,102 @@
  * (nonzero). */
 int verbose;
 
-/* The file name of the .b91 input file */
+/* Which execution engine to run the program with; one of the ENGINE_*
+ * constants in sim.h. The --engine command line option sets it. */
+int engine = ENGINE_SWITCH;
+
+/* Whether to do I/O a word at a time even when neither standard input
+ * nor standard output is a terminal. The --interactive command line
+ * option sets it. */
+int interactive;
+
+/* Whether the CPUs a program spawns take turns in one thread instead
+ * of running at once in threads of their own, so that the run is
+ * repeatable (see cpu.c). The --deterministic command line option
+ * sets it. */
+int deterministic;
+
+/* Whether the threaded engine fuses common instruction sequences into
+ * superinstructions (see threaded.c). The --no-fuse command line
+ * option turns it off; --fuse-stats reports how many of the
+ * instructions executed were fused. */
+int fuse = 1;
+static int fusestats;
+
+/* The file name of the .b91 input file, or of the manifest in batch
+ * mode */
 static char *file;
 
+/* The file name of the image file to write, if the --compile-image
+ * command line option was given */
+static char *imagefile;
+
+/* The file to write the profile report to when the program halts, if
+ * the --profile command line option was given. */
+char *profilefile;
+
+/* Resource limits for untrusted programs, from the --max-insns,
+ * --timeout and --max-mem command line options: how many instructions
+ * a run may execute (zero for no limit), how many seconds it may take
+ * (zero for no limit) and how many words of memory a computer may have */
+size_t maxinsns;
+double timeout;
+size_t maxmem = MEMRESERVE;
+
+/* The file to write the execution trace to, if the --trace command
+ * line option was given, and how many instructions it keeps */
+static char *tracefile;
+static size_t tracesize = 1 << 16;
+
+/* The I/O log to write if the --record command line option was given,
+ * or to replay instead of doing I/O if --replay was (see iolog.c) */
+static char *recordfile;
+static char *replayfile;
+
+/* The trace file to print, if the --dump-trace command line option
+ * was given */
+static char *dumpfile;
+
+/* The program to disassemble, if the --disasm command line option was
+ * given */
+static char *disasmfile;
+
+/* Port bindings from --port command line options, see bindport() */
+static char *portspecs[NPORTS];
+static int nportspec;
+
+/* The file to write a snapshot to, if the --snapshot-at command line
+ * option was given, and the program counter or the count of
+ * instructions executed at which to take it (SIZE_MAX for neither).
+ * The snapshot is taken before the instruction at snappc is executed
+ * for the first time. */
+char *snapfile;
+size_t snappc = SIZE_MAX;
+size_t snapinsns = SIZE_MAX;
+
+/* Where --snapshot-at says to take the snapshot, until the program is
+ * loaded and symbols can be looked up */
+static char *snapat;
+
+/* The snapshot to restore instead of loading a program, if the
+ * --restore command line option was given */
+static char *restorefile;
+
+/* Nonzero if the --batch command line option was given */
+static int batchmode;
+
+/* Nonzero if the --server command line option was given, and the
+ * socket to listen on if --socket was also given */
+static int servermode;
+static char *socketfile;
+
+/* How many threads to run batch jobs in; zero means one per processor */
+static int nthread;
+
+/* How many batch jobs of the same program to run in lockstep at once
+ * (see lockstep.c); zero means one job at a time */
+static int nlanes;
+
 /*
  * usage -- print instructions on command line usage and exit. Called
  * if the command line syntax is incorrect or there are unknown
@@ -32,15 +137,73 @@ static char *file;
  */
 static void usage(void)
 {
-    fprintf(stderr, "usage: ckone [-v] file.b91\n");
+    fprintf(stderr, "usage: ckone [-v] [--engine switch|threaded|jit] [--no-fuse] [--fuse-stats] [--deterministic] [--interactive]\n");
+    fprintf(stderr, "             [--port n=device] [--trace file [--trace-size n]] [--profile file] [--record file|--replay file]\n");
+    fprintf(stderr, "             [limits] [--snapshot-at pc=addr|insns=n file] file.b91|--restore file\n");
+    fprintf(stderr, "       ckone [--engine switch|threaded|jit] [--no-fuse] [--deterministic] [--threads n] [--lanes n] [limits] --batch manifest\n");
+    fprintf(stderr, "       ckone [--engine switch|threaded|jit] [--no-fuse] [--deterministic] [limits] --server [--socket file] file.b91\n");
+    fprintf(stderr, "       ckone --compile-image file.b91 image\n");
+    fprintf(stderr, "       ckone --dump-trace file [file.b91]\n");
+    fprintf(stderr, "       ckone --disasm file.b91\n");
+    fprintf(stderr, "limits: [--max-insns n] [--timeout seconds] [--max-mem words]\n");
     exit(1);
 }
 
+/*
+ * parseengine -- map an execution engine name to an ENGINE_* constant
+ *
+ * name -- the name given on the command line
+ * return value -- the engine constant
+ *
+ * Calls usage() if the name is unknown.
+ */
+static int parseengine(char *name)
+{
+    if(!strcmp(name, "switch")) return(ENGINE_SWITCH);
+    if(!strcmp(name, "threaded")) return(ENGINE_THREADED);
+    if(!strcmp(name, "jit")) return(ENGINE_JIT);
+    usage();
+    return(0);
+}
+
+/*
+ * parsesnapat -- set snappc or snapinsns from the argument of the
+ * --snapshot-at command line option
+ *
+ * m -- the computer, with the program loaded
+ * spec -- "pc=" followed by an address or a symbol, or "insns="
+ * followed by a count of instructions
+ *
+ * Calls usage() if the argument is malformed.
+ */
+static void parsesnapat(struct machine *m, char *spec)
+{
+    struct syment *ent;
+    char *end;
+
+    if(!strncmp(spec, "insns=", 6))
+    {
+        snapinsns = strtoul(spec+6, &end, 10);
+        if((end == spec+6) || *end) usage();
+    }
+    else if(!strncmp(spec, "pc=", 3))
+    {
+        snappc = strtoul(spec+3, &end, 10);
+        if((end == spec+3) || *end)
+        {
+            if(!(ent = findsym(m, spec+3))) dies("no such symbol", spec+3);
+            snappc = ent->off;
+        }
+    }
+    else usage();
+}
+
 /*
  * main -- standard C main program.
  */
 int main(int argc, char **argv)
 {
+    struct machine m;
     int i;
 
     /* Parse command line arguments */
@@ -49,28 +212,105 @@ int main(int argc, char **argv)
     {
         if(!strcmp(argv[i], "--")) { i++; break; }
         else if(!strcmp(argv[i], "-v")) verbose = 1;
+        else if(!strcmp(argv[i], "--engine") && (i+1 < argc)) engine = parseengine(argv[++i]);
+        else if(!strcmp(argv[i], "--interactive")) interactive = 1;
+        else if(!strcmp(argv[i], "--deterministic")) deterministic = 1;
+        else if(!strcmp(argv[i], "--no-fuse")) fuse = 0;
+        else if(!strcmp(argv[i], "--fuse-stats")) fusestats = 1;
+        else if(!strcmp(argv[i], "--port") && (i+1 < argc) && (nportspec < NPORTS)) portspecs[nportspec++] = argv[++i];
+        else if(!strcmp(argv[i], "--batch")) batchmode = 1;
+        else if(!strcmp(argv[i], "--server")) servermode = 1;
+        else if(!strcmp(argv[i], "--socket") && (i+1 < argc)) socketfile = argv[++i];
+        else if(!strcmp(argv[i], "--threads") && (i+1 < argc)) nthread = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--lanes") && (i+1 < argc)) nlanes = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--compile-image") && (i+2 < argc))
+        {
+            file = argv[++i];
+            imagefile = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--trace") && (i+1 < argc)) tracefile = argv[++i];
+        else if(!strcmp(argv[i], "--trace-size") && (i+1 < argc)) tracesize = strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--profile") && (i+1 < argc)) profilefile = argv[++i];
+        else if(!strcmp(argv[i], "--max-insns") && (i+1 < argc)) maxinsns = strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--timeout") && (i+1 < argc)) timeout = strtod(argv[++i], 0);
+        else if(!strcmp(argv[i], "--max-mem") && (i+1 < argc)) maxmem = strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--snapshot-at") && (i+2 < argc))
+        {
+            snapat = argv[++i];
+            snapfile = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--restore") && (i+1 < argc)) restorefile = argv[++i];
+        else if(!strcmp(argv[i], "--dump-trace") && (i+1 < argc)) dumpfile = argv[++i];
+        else if(!strcmp(argv[i], "--record") && (i+1 < argc)) recordfile = argv[++i];
+        else if(!strcmp(argv[i], "--replay") && (i+1 < argc)) replayfile = argv[++i];
+        else if(!strcmp(argv[i], "--disasm") && (i+1 < argc)) disasmfile = argv[++i];
         else if(!strcmp(argv[i], "-h")) usage();
         else usage();
         i++;
     }
-    if(i != argc-1) usage();
+    if(imagefile)
+    {
+        if((i != argc) || batchmode) usage();
+        initmachine(&m);
+        loadfile(&m, file);
+        writeimage(&m, imagefile);
+        return(0);
+    }
+    if(disasmfile)
+    {
+        if((i != argc) || batchmode) usage();
+        initmachine(&m);
+        loadfile(&m, disasmfile);
+        disasmimage(&m, stdout);
+        return(0);
+    }
+    if(dumpfile)
+    {
+        if((i < argc-1) || batchmode) usage();
+        initmachine(&m);
+        if(i < argc) loadfile(&m, argv[i]);
+        dumptrace(&m, dumpfile);
+        return(0);
+    }
+    if(i != argc-(restorefile ? 0 : 1)) usage();
     file = argv[i];
+    if((batchmode || servermode) && (verbose || tracefile || profilefile || nportspec || snapfile || restorefile
+                                     || fusestats || recordfile || replayfile))
+        usage();
+    if(recordfile && replayfile) usage();
+    if(batchmode && servermode) usage();
+    if(socketfile && !servermode) usage();
+    if(batchmode) return(batch(file, nthread, nlanes));
+    if(servermode) return(serve(file, socketfile));
 
     /* Engage the simulator! */
-    parsefile(file);
+    initmachine(&m);
+    for(i=0; i<nportspec; i++) bindport(&m, portspecs[i]);
+    if(restorefile) loadsnap(&m, restorefile);
+    else loadfile(&m, file);
+    if(snapat) parsesnapat(&m, snapat);
+    if(recordfile) startrecord(&m, recordfile);
+    if(replayfile) startreplay(&m, replayfile);
     if(verbose)
     {
         printf("Disassembly of code area at program start:\n");
-        disasm(mem, codeoff, codesize);
+        disasm(&m, m.codeoff, m.codesize);
         printf("\n");
         printf("Running program:\n");
     }
-    simulate();
+    if(tracefile) starttrace(&m, tracefile, tracesize);
+    flushondie(&m);
+    simulate(&m);
+    flushondie(0);
+    if(fusestats) printfusion(&m, stderr);
+    endiolog(&m);
+    freedevices(&m);
+    endtrace(&m);
     if(verbose)
     {
         printf("\n");
         printf("Data area symbols at program halt:\n");
-        printsymtab();
+        printsymtab(&m);
     }
     return(0);
 }
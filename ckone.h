@@ -3,3 +3,14 @@
  * are only called in verbose mode. */
 
 extern int verbose;
+extern int engine;
+extern int fuse;
+extern int interactive;
+extern int deterministic;
+extern char *profilefile;
+extern size_t maxinsns;
+extern double timeout;
+extern size_t maxmem;
+extern char *snapfile;
+extern size_t snappc;
+extern size_t snapinsns;
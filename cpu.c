@@ -0,0 +1,521 @@
+/* Multiple CPUs. A program can start more CPUs with the SPAWN
+ * supervisor call, which share the memory of the computer and each run
+ * on a host thread of their own, or, in deterministic mode, take turns
+ * in the thread of the first CPU. Each CPU is a struct machine of its
+ * own, a copy of the one that spawned it with its own registers,
+ * instruction cache and instruction count, pointing at the same
+ * memory. Memory doesn't grow while a program runs, so the memory
+ * array never moves under the other CPUs.
+ *
+ * The supervisor calls take their arguments from the stack and leave
+ * their results on it, the word pushed last being popped first:
+ *
+ * SPAWN (16) pops the stack address and the start address of the new
+ * CPU and pushes its number. The new CPU starts with the registers of
+ * the one that spawned it, except that its stack and frame pointers
+ * both hold the stack address; since PUSH increments the stack pointer
+ * before storing, that is the address just below the new stack.
+ *
+ * JOIN (17) pops the number of a CPU and waits for it to halt. Any
+ * CPU but the first can be joined, once, by any other CPU.
+ *
+ * CAS (18) pops a new word, an expected word and an address, replaces
+ * the word at the address with the new word if it equals the expected
+ * word, and pushes the word that was there.
+ *
+ * FAA (19) pops a word and an address, adds the word to the word at
+ * the address, and pushes the word that was there.
+ *
+ * HALT stops the CPU that calls it. The first CPU waits for all the
+ * others to halt first, and only then prints "HALT" and ends the run.
+ * If any CPU error-exits, so does the run, with the error message of
+ * that CPU prefixed by its number, and the other CPUs are stopped. If
+ * every CPU is waiting for another to halt, the run error-exits with a
+ * deadlock. The resource limits apply to each CPU on its own.
+ *
+ * All the CPUs do their I/O through the devices of the first one, one
+ * word at a time, under a lock. Verbose mode, tracing and profiling
+ * only follow the first CPU, and no snapshot can be taken of a program
+ * that has spawned CPUs.
+ *
+ * The memory model is this. A word is always read and written whole,
+ * so no CPU sees half of a store by another. Otherwise, loads and
+ * stores (including those of the stack operations) are ordered as the
+ * host orders them: on x86-64 stores become visible to the other CPUs
+ * in the order they were made, but a load can be done before an earlier
+ * store to another address is visible; other hosts can reorder more.
+ * CAS and FAA are atomic, are done in an order all CPUs agree on, and
+ * are barriers: everything a CPU did before one is visible to the
+ * other CPUs before it, and nothing it does after one is visible
+ * before it. SPAWN is a barrier too, so the new CPU sees everything
+ * its spawner wrote before spawning it, and so is halting, so a CPU
+ * returning from JOIN sees everything the joined CPU wrote. Programs
+ * should use CAS or FAA for anything the CPUs share while running.
+ * Each CPU has its own cache of decoded instructions, so a store into
+ * the code area changes the program only for the CPU that made it.
+ *
+ * In deterministic mode (the --deterministic command line option)
+ * there is no concurrency: all the CPUs run on the reference engine in
+ * the host thread of the first one, taking turns in the order of their
+ * numbers. A turn lasts TURN instructions, up to the end of the basic
+ * block, or until the CPU halts or has to wait in JOIN or HALT; then
+ * it does the supervisor call again in its next turn. A run thus
+ * does the same thing every time, which threads don't. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "reg.h"
+#include "icache.h"
+#include "ckone.h"
+#include "sim.h"
+#include "jit.h"
+#include "cpu.h"
+
+/* How many instructions a CPU executes in its turn in deterministic
+ * mode, give or take the rest of a basic block */
+#define TURN 1024
+
+/* The CPUs of a computer */
+struct smp
+{
+    /* Guards the members below, and the devices of the first CPU */
+    pthread_mutex_t lock;
+
+    /* Broadcast whenever a CPU halts or the CPUs are to stop */
+    pthread_cond_t changed;
+    size_t generation; /* count of broadcasts */
+
+    struct machine *cpus[MAXCPUS]; /* cpus[0] is the computer itself */
+    pthread_t threads[MAXCPUS]; /* host threads of the others, unless deterministic */
+    int halted[MAXCPUS]; /* nonzero once a CPU has halted or died */
+    int joined[MAXCPUS]; /* nonzero once a CPU has been joined */
+    size_t ncpu; /* count of CPUs */
+    size_t nlive; /* count of CPUs that haven't halted */
+    size_t nwaiting; /* count of CPUs waiting for others since the last broadcast */
+
+    int stop; /* nonzero when every CPU is to stop */
+    char error[256]; /* the error message of the run, if another CPU died */
+    int status; /* the exit status it died with */
+
+    /* Deterministic mode only */
+    size_t turnend[MAXCPUS]; /* value of retired at which each CPU's turn ends */
+    size_t lastretired; /* retired of the first CPU at the end of its last turn */
+};
+
+/* Nonzero while this thread holds the lock, so that it can be released
+ * if the thread dies holding it */
+static THREADLOCAL int holding;
+
+/*
+ * lockcpus -- take the lock of the CPUs of a computer
+ *
+ * m -- any of the CPUs
+ */
+void lockcpus(struct machine *m)
+{
+    pthread_mutex_lock(&m->smp->lock);
+    holding = 1;
+}
+
+/*
+ * unlockcpus -- release the lock of the CPUs of a computer
+ *
+ * m -- any of the CPUs
+ */
+void unlockcpus(struct machine *m)
+{
+    holding = 0;
+    pthread_mutex_unlock(&m->smp->lock);
+}
+
+/*
+ * firstcpu -- find the first CPU of a computer, whose devices all the
+ * CPUs use
+ *
+ * m -- any of the CPUs
+ * return value -- the first CPU
+ */
+struct machine *firstcpu(struct machine *m)
+{
+    return(m->smp->cpus[0]);
+}
+
+/*
+ * notify -- wake up the CPUs waiting for others. Called with the lock
+ * held.
+ *
+ * s -- the CPUs
+ */
+static void notify(struct smp *s)
+{
+    s->generation++;
+    s->nwaiting = 0;
+    pthread_cond_broadcast(&s->changed);
+}
+
+/*
+ * stopped -- error-exit because the CPUs have been told to stop.
+ * Called with the lock held, which is released.
+ *
+ * m -- the CPU
+ *
+ * The first CPU dies with the error of the CPU that died; the others
+ * just end.
+ */
+static void stopped(struct machine *m)
+{
+    struct smp *s = m->smp;
+    char msg[sizeof(s->error)];
+    int status;
+
+    strcpy(msg, s->error);
+    status = s->status;
+    unlockcpus(m);
+    if(m->cpu) die("stopped");
+    if(status == LIMITSTATUS) dielimit(msg);
+    die(msg);
+}
+
+/*
+ * fail -- record the error-exit of a CPU other than the first and tell
+ * the CPUs to stop. Called with the lock held.
+ *
+ * m -- the CPU
+ * msg -- its error message
+ * status -- its exit status
+ *
+ * Only the first error counts.
+ */
+static void fail(struct machine *m, char *msg, int status)
+{
+    struct smp *s = m->smp;
+
+    if(s->stop) return;
+    snprintf(s->error, sizeof(s->error), "CPU %zu: %s", m->cpu, msg);
+    s->status = status;
+    s->stop = 1;
+    notify(s);
+}
+
+/*
+ * finished -- tell whether the CPUs a CPU is waiting for have halted.
+ * Called with the lock held.
+ *
+ * s -- the CPUs
+ * cpu -- the number of the CPU waited for, or 0 for all but the first
+ */
+static int finished(struct smp *s, size_t cpu)
+{
+    return(cpu ? s->halted[cpu] : (s->nlive == 1));
+}
+
+/*
+ * await -- wait for a CPU, or all but the first, to halt. Called with
+ * the lock held.
+ *
+ * m -- the CPU that waits
+ * cpu -- as for finished()
+ * return value -- nonzero once they have halted. In deterministic mode
+ * returns zero instead of waiting, and the caller must give up its turn
+ * and try again.
+ *
+ * Error-exits if the CPUs are stopped meanwhile, or if every CPU that
+ * hasn't halted would be waiting.
+ */
+static int await(struct machine *m, size_t cpu)
+{
+    struct smp *s = m->smp;
+    size_t gen;
+
+    if(deterministic) return(finished(s, cpu));
+    for(;;)
+    {
+        if(s->stop) stopped(m);
+        if(finished(s, cpu)) break;
+        if(++s->nwaiting == s->nlive)
+        {
+            unlockcpus(m);
+            die("deadlock: every CPU is waiting for another to halt");
+        }
+        gen = s->generation;
+        while((s->generation == gen) && !s->stop) pthread_cond_wait(&s->changed, &s->lock);
+    }
+    return(1);
+}
+
+/*
+ * cputhread -- host thread of a CPU other than the first
+ *
+ * arg -- the CPU
+ * return value -- a null pointer
+ */
+static void *cputhread(void *arg)
+{
+    struct machine *m = arg;
+    struct smp *s = m->smp;
+    char *error;
+
+    error = catchdie(runcpuarg, m);
+    if(!holding) lockcpus(m);
+    if(error) fail(m, error, caughtstatus());
+    s->halted[m->cpu] = 1;
+    s->nlive--;
+    notify(s);
+    unlockcpus(m);
+    jit_release();
+    return(0);
+}
+
+/*
+ * startcpus -- set up a computer to have more than one CPU
+ *
+ * m -- the computer, which becomes the first CPU
+ */
+static void startcpus(struct machine *m)
+{
+    struct smp *s;
+
+    if(!(s = calloc(1, sizeof(*s)))) die("out of memory");
+    if(pthread_mutex_init(&s->lock, 0) || pthread_cond_init(&s->changed, 0)) die("cannot create lock");
+    s->cpus[0] = m;
+    s->ncpu = s->nlive = 1;
+    s->turnend[0] = m->retired + TURN;
+    s->lastretired = m->retired;
+    m->smp = s;
+}
+
+/*
+ * spawncpu -- start a new CPU
+ *
+ * m -- the CPU spawning it
+ * pc -- the address to start at
+ * sp -- the initial value of its stack and frame pointers
+ * return value -- the number of the new CPU
+ */
+size_t spawncpu(struct machine *m, size_t pc, word_t sp)
+{
+    struct smp *s;
+    struct machine *c;
+    size_t n;
+
+    if(snapfile) die("cannot take a snapshot of several CPUs");
+    if(!m->smp) startcpus(m);
+    s = m->smp;
+
+    /* A copy of the spawning CPU with nothing of its own but the
+     * instruction cache */
+    if(!(c = malloc(sizeof(*c)))) die("out of memory");
+    *c = *m;
+    c->icache = 0;
+    c->icachesize = 0;
+    icache_resize(c, c->memsize);
+    c->kept = 0;
+    c->trace = 0;
+    c->profile = 0;
+    c->iolog = 0;
+    c->devices = 0;
+    c->outbuf = 0;
+    c->outlen = c->outcap = 0;
+    c->input = 0;
+    c->ninput = c->inputcap = c->inputpos = 0;
+    c->inputread = 0;
+
+    c->pc = pc;
+    setreg(c, SP, sp);
+    setreg(c, FP, sp);
+    c->halted = 0;
+    c->yield = 0;
+    c->retired = c->fused = c->codestores = 0;
+    c->nextcheck = 0;
+
+    lockcpus(m);
+    if(s->stop)
+    {
+        free(c->icache);
+        free(c);
+        stopped(m);
+    }
+    if(s->ncpu == MAXCPUS)
+    {
+        unlockcpus(m);
+        free(c->icache);
+        free(c);
+        die("too many CPUs");
+    }
+    n = c->cpu = s->ncpu;
+    s->cpus[n] = c;
+    if(!deterministic && pthread_create(&s->threads[n], 0, cputhread, c))
+    {
+        unlockcpus(m);
+        free(c->icache);
+        free(c);
+        die("cannot create thread");
+    }
+    s->ncpu++;
+    s->nlive++;
+    unlockcpus(m);
+
+    /* Have the engine call checklimits() soon, and from then on
+     * regularly, so that checkcpus() gets to run */
+    m->nextcheck = m->retired;
+    return(n);
+}
+
+/*
+ * joincpu -- wait for a CPU to halt
+ *
+ * m -- the CPU waiting
+ * cpu -- the number of the CPU to wait for
+ * return value -- nonzero once it has halted; zero if the caller must
+ * try again in its next turn, see await()
+ */
+int joincpu(struct machine *m, size_t cpu)
+{
+    struct smp *s = m->smp;
+
+    if(!s) die("no such CPU to join");
+    lockcpus(m);
+    if(!cpu || (cpu >= s->ncpu) || (cpu == m->cpu) || s->joined[cpu])
+    {
+        unlockcpus(m);
+        die("no such CPU to join");
+    }
+    if(!await(m, cpu))
+    {
+        unlockcpus(m);
+        return(0);
+    }
+    s->joined[cpu] = 1;
+    unlockcpus(m);
+    return(1);
+}
+
+/*
+ * joinall -- wait for every CPU but the first to halt
+ *
+ * m -- the first CPU
+ * return value -- as for joincpu()
+ */
+int joinall(struct machine *m)
+{
+    int done;
+
+    lockcpus(m);
+    done = await(m, 0);
+    unlockcpus(m);
+    return(done);
+}
+
+/*
+ * checkcpus -- see whether a CPU must stop or give up its turn. Called
+ * by checklimits().
+ *
+ * m -- the CPU
+ */
+void checkcpus(struct machine *m)
+{
+    struct smp *s = m->smp;
+
+    if(deterministic)
+    {
+        if(m->retired >= s->turnend[m->cpu]) m->yield = 1;
+        else if(m->nextcheck > s->turnend[m->cpu]) m->nextcheck = s->turnend[m->cpu];
+        return;
+    }
+    lockcpus(m);
+    if(s->stop) stopped(m);
+    unlockcpus(m);
+}
+
+/*
+ * turn -- run the turn of a CPU through catchdie()
+ *
+ * arg -- the CPU
+ */
+static void turn(void *arg)
+{
+    runturn(arg);
+}
+
+/*
+ * taketurns -- in deterministic mode, let the CPUs other than the first
+ * take their turns
+ *
+ * m -- the first CPU, at the end of its turn
+ */
+void taketurns(struct machine *m)
+{
+    struct smp *s = m->smp;
+    struct machine *c;
+    char msg[sizeof(s->error)];
+    char *error;
+    size_t i, start;
+    int progress;
+
+    progress = (m->retired != s->lastretired);
+    for(i=1; i<s->ncpu; i++)
+    {
+        if(s->halted[i]) continue;
+        c = s->cpus[i];
+        start = c->retired;
+        s->turnend[i] = c->retired + TURN;
+        if(c->nextcheck > s->turnend[i]) c->nextcheck = s->turnend[i];
+        if((error = catchdie(turn, c)))
+        {
+            snprintf(msg, sizeof(msg), "CPU %zu: %s", i, error);
+            if(caughtstatus() == LIMITSTATUS) dielimit(msg);
+            die(msg);
+        }
+        if(c->halted)
+        {
+            s->halted[i] = 1;
+            s->nlive--;
+        }
+        if(c->retired != start) progress = 1;
+    }
+    if(!progress) die("deadlock: every CPU is waiting for another to halt");
+
+    m->yield = 0;
+    s->lastretired = m->retired;
+    s->turnend[0] = m->retired + TURN;
+    if(m->nextcheck > s->turnend[0]) m->nextcheck = s->turnend[0];
+}
+
+/*
+ * endcpus -- stop the CPUs other than the first and free them
+ *
+ * m -- the first CPU, which has halted or died
+ *
+ * The computer is left with a single CPU.
+ */
+void endcpus(struct machine *m)
+{
+    struct smp *s = m->smp;
+    size_t i;
+
+    if(!s) return;
+    if(!holding) lockcpus(m);
+    s->stop = 1;
+    notify(s);
+    unlockcpus(m);
+    for(i=1; i<s->ncpu; i++)
+    {
+        if(!deterministic) pthread_join(s->threads[i], 0);
+        icache_free(s->cpus[i]);
+        free(s->cpus[i]);
+    }
+    pthread_cond_destroy(&s->changed);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    m->smp = 0;
+}
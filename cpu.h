@@ -0,0 +1,21 @@
+/* Multiple CPUs. A program can start more CPUs with the SPAWN
+ * supervisor call, which share the memory of the computer and each run
+ * on a host thread of their own, or, in deterministic mode, take turns
+ * in the thread of the first CPU. See cpu.c for the supervisor calls
+ * and the memory model. "word.h" must be included before this
+ * header. */
+
+/* Most CPUs a computer can have, counting the first */
+#define MAXCPUS 64
+
+struct machine;
+
+size_t spawncpu(struct machine *m, size_t pc, word_t sp);
+int joincpu(struct machine *m, size_t cpu);
+int joinall(struct machine *m);
+void checkcpus(struct machine *m);
+void taketurns(struct machine *m);
+void lockcpus(struct machine *m);
+void unlockcpus(struct machine *m);
+struct machine *firstcpu(struct machine *m);
+void endcpus(struct machine *m);
@@ -0,0 +1,474 @@
+/* I/O devices. Each port number that IN and OUT instructions can name
+ * is bound to a device, which is an instance of one of the backends
+ * below with its own state. By default the keyboard (KBD, port 1) and
+ * standard input (STDIN, 6) read decimal integers from the computer's
+ * input stream with an "Input: " prompt, and the display (CRT, 0) and
+ * standard output (STDOUT, 7) write them to its output stream, see
+ * io.c. Other bindings are made with bindport(), for which the
+ * command line gives specifications like "6=in:data.bin".
+ *
+ * Binary files hold words as they are in host memory, so an input file
+ * can be mapped and read at memory speed. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "io.h"
+#include "ckone.h"
+#include "iolog.h"
+#include "cpu.h"
+#include "dev.h"
+
+/* A device bound to a port */
+struct device
+{
+    /* Operations; a null pointer means the device can't do it */
+    word_t (*in)(struct machine *m, struct device *d);
+    void (*out)(struct machine *m, struct device *d, word_t val);
+    void (*close)(struct device *d);
+
+    /* State of the backend */
+    FILE *f; /* stream of stream backends */
+    word_t *words; /* words of array backends */
+    size_t nwords; /* count of words */
+    size_t pos; /* index of the next word to read */
+    size_t maplen; /* bytes of the file mapped at words, or zero */
+};
+
+/*
+ * Console backend
+ */
+
+/*
+ * input -- read a signed decimal integer from the computer's input
+ * stream, normally standard input
+ *
+ * m -- the computer
+ * d -- the device
+ * return value -- the unsigned word representation of the integer read
+ *
+ * Dies on input error. Integer overflow checking not done.
+ */
+static word_t input(struct machine *m, struct device *d)
+{
+    word_t val;
+
+    putstr(m, "Input: ");
+    if(!m->buffered) flushio(m);
+    if(!getword(m, &val)) die("cannot read from standard input");
+    if(verbose) fprintf(m->out, "Received input: %zd\n", (ssize_t)(sword_t)val);
+    return(val);
+}
+
+/*
+ * output -- write a signed decimal integer to the computer's output
+ * stream, normally standard output
+ *
+ * m -- the computer
+ * d -- the device
+ * val -- the unsigned word representation of the integer to write
+ */
+static void output(struct machine *m, struct device *d, word_t val)
+{
+    putstr(m, "Output: ");
+    putword(m, val);
+    putstr(m, "\n");
+    if(!m->buffered) flushio(m);
+}
+
+/*
+ * opencon -- set up a console device
+ *
+ * d -- the device
+ * arg -- unused
+ */
+static void opencon(struct device *d, char *arg)
+{
+    d->in = input;
+    d->out = output;
+}
+
+/*
+ * Stream backends
+ */
+
+/* Devices reading a file of decimal integers, writing one, reading a
+ * file of binary words and writing one */
+
+static word_t textin(struct machine *m, struct device *d)
+{
+    ssize_t ss;
+
+    if(fscanf(d->f, "%zd", &ss) != 1) die("cannot read from input device");
+    return(ss);
+}
+
+static void textout(struct machine *m, struct device *d, word_t val)
+{
+    fprintf(d->f, "%zd\n", (ssize_t)(sword_t)val);
+}
+
+static word_t binin(struct machine *m, struct device *d)
+{
+    word_t val;
+
+    if(fread(&val, sizeof(val), 1, d->f) != 1) die("cannot read from input device");
+    return(val);
+}
+
+static void binout(struct machine *m, struct device *d, word_t val)
+{
+    fwrite(&val, sizeof(val), 1, d->f);
+}
+
+static void closestream(struct device *d)
+{
+    int err;
+
+    err = ferror(d->f);
+    if(fclose(d->f) || err) die("cannot write to output device");
+    d->f = 0;
+}
+
+/*
+ * openstream -- open the file of a stream backend
+ *
+ * d -- the device
+ * arg -- the name of the file
+ * mode -- the mode to open it in
+ */
+static void openstream(struct device *d, char *arg, char *mode)
+{
+    if(!(d->f = fopen(arg, mode))) dies("cannot open device file", arg);
+    d->close = closestream;
+}
+
+static void opentextin(struct device *d, char *arg)
+{
+    openstream(d, arg, "r");
+    d->in = textin;
+}
+
+static void opentextout(struct device *d, char *arg)
+{
+    openstream(d, arg, "w");
+    d->out = textout;
+}
+
+static void openout(struct device *d, char *arg)
+{
+    openstream(d, arg, "wb");
+    d->out = binout;
+}
+
+/*
+ * Array backends
+ */
+
+/* Devices reading words from an array in memory, either given on the
+ * command line or mapped from a file */
+
+static word_t arrayin(struct machine *m, struct device *d)
+{
+    if(d->pos == d->nwords) die("cannot read from input device");
+    return(d->words[d->pos++]);
+}
+
+static void closearray(struct device *d)
+{
+    if(d->maplen) munmap(d->words, d->maplen);
+    else free(d->words);
+    d->words = 0;
+}
+
+/*
+ * openwords -- open an array backend holding the words given
+ *
+ * d -- the device
+ * arg -- the words as comma-separated decimal integers
+ */
+static void openwords(struct device *d, char *arg)
+{
+    char *end;
+
+    d->in = arrayin;
+    d->close = closearray;
+    while(*arg)
+    {
+        if(!(d->words = realloc(d->words, size_mul(d->nwords+1, sizeof(word_t))))) die("out of memory");
+        d->words[d->nwords++] = strtol(arg, &end, 10);
+        if((end == arg) || (*end && (*end != ','))) die("bad word list for device");
+        arg = *end ? end+1 : end;
+    }
+}
+
+/*
+ * openin -- open an input backend reading the binary words of a file,
+ * by mapping the file if possible
+ *
+ * d -- the device
+ * arg -- the name of the file
+ *
+ * Files that can't be mapped, like pipes, are read as a stream.
+ */
+static void openin(struct device *d, char *arg)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if((fd = open(arg, O_RDONLY)) == -1) dies("cannot open device file", arg);
+    if(fstat(fd, &st)) dies("cannot open device file", arg);
+    if(S_ISREG(st.st_mode))
+    {
+        if(st.st_size % sizeof(word_t)) dies("size of device file is not a whole number of words:", arg);
+        d->in = arrayin;
+        d->close = closearray;
+        d->nwords = st.st_size / sizeof(word_t);
+        if(st.st_size)
+        {
+            map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map == MAP_FAILED) dies("cannot map device file", arg);
+            d->words = map;
+            d->maplen = st.st_size;
+        }
+        close(fd);
+        return;
+    }
+    if(!(d->f = fdopen(fd, "rb"))) dies("cannot open device file", arg);
+    d->in = binin;
+    d->close = closestream;
+}
+
+/* Table mapping the backend names of port specifications to functions
+ * setting up a device. Each takes the device, which is all zeros, and
+ * the rest of the specification after the colon. */
+static struct
+{
+    char *name;
+    void (*open)(struct device *d, char *arg);
+} backends[] =
+{
+    {"console", opencon},
+    {"in", openin},
+    {"out", openout},
+    {"textin", opentextin},
+    {"textout", opentextout},
+    {"words", openwords},
+};
+
+/*
+ * Port table
+ */
+
+/*
+ * initdevices -- bind the standard ports of a computer to the console
+ * if no devices are bound yet
+ *
+ * m -- the computer
+ */
+static void initdevices(struct machine *m)
+{
+    struct device *d;
+
+    if(m->devices) return;
+    if(!(m->devices = calloc(NPORTS, sizeof(struct device)))) die("out of memory");
+    d = m->devices;
+    d[CRT].out = d[STDOUT].out = output;
+    d[KBD].in = d[STDIN].in = input;
+}
+
+/*
+ * bindport -- bind a port of a computer to a new device
+ *
+ * m -- the computer
+ * spec -- "port=backend" or "port=backend:argument", where the
+ * backend is one of
+ *   console -- decimal integers read from the computer's input stream
+ *   and written to its output stream, with "Input:" and "Output:"
+ *   in:file -- binary words read from a file
+ *   out:file -- binary words written to a file
+ *   textin:file -- decimal integers read from a file
+ *   textout:file -- decimal integers written to a file, one per line
+ *   words:n,n,... -- the words given, read in order
+ *
+ * Dies if the specification is bad or the file cannot be opened. The
+ * device previously bound to the port is closed.
+ */
+void bindport(struct machine *m, char *spec)
+{
+    struct device d;
+    char *end, *arg;
+    size_t port, i, n;
+
+    initdevices(m);
+    port = strtoul(spec, &end, 10);
+    if((end == spec) || (*end != '=')) dies("bad port specification", spec);
+    if(port >= NPORTS) dies("no such port", spec);
+    end++;
+    arg = strchr(end, ':');
+    n = arg ? (size_t)(arg-end) : strlen(end);
+    for(i=0; i<sizeof(backends)/sizeof(backends[0]); i++)
+        if((strlen(backends[i].name) == n) && !strncmp(backends[i].name, end, n)) break;
+    if(i == sizeof(backends)/sizeof(backends[0])) dies("no such device backend", spec);
+    memset(&d, 0, sizeof(d));
+    backends[i].open(&d, arg ? arg+1 : "");
+    if(m->devices[port].close) m->devices[port].close(&m->devices[port]);
+    m->devices[port] = d;
+}
+
+/*
+ * portin -- read a word from the device bound to a port of a single
+ * CPU, see devin()
+ */
+static word_t portin(struct machine *m, size_t port)
+{
+    struct device *d;
+    word_t val;
+
+    /* A replayed run has no devices, but a port that cannot exist
+     * fails as it did in the recorded run */
+    if(port >= NPORTS) die("no such input device");
+    if(replaying(m)) return(replayin(m, port));
+    initdevices(m);
+    if(!m->devices[port].in) die("no such input device");
+    d = &m->devices[port];
+    val = d->in(m, d);
+    if(m->iolog) login(m, port, val);
+    return(val);
+}
+
+/*
+ * portout -- write a word to the device bound to a port of a single
+ * CPU, see devout()
+ */
+static void portout(struct machine *m, size_t port, word_t val)
+{
+    struct device *d;
+
+    initdevices(m);
+    if((port >= NPORTS) || !m->devices[port].out) die("no such output device");
+    d = &m->devices[port];
+    if(m->iolog) logout(m, port, val);
+    d->out(m, d, val);
+}
+
+/*
+ * devin -- read a word from the device bound to a port
+ *
+ * m -- the computer
+ * port -- the port number
+ * return value -- the word
+ *
+ * When replaying a recorded run, the word comes from the log instead,
+ * see iolog.c. The CPUs a program spawns all read from the devices of
+ * the first CPU, one at a time (see cpu.c).
+ */
+word_t devin(struct machine *m, size_t port)
+{
+    word_t val;
+
+    if(!m->smp) return(portin(m, port));
+    lockcpus(m);
+    val = portin(firstcpu(m), port);
+    unlockcpus(m);
+    return(val);
+}
+
+/*
+ * devout -- write a word to the device bound to a port
+ *
+ * m -- the computer
+ * port -- the port number
+ * val -- the word
+ *
+ * As with devin(), all CPUs write to the devices of the first.
+ */
+void devout(struct machine *m, size_t port, word_t val)
+{
+    if(!m->smp)
+    {
+        portout(m, port, val);
+        return;
+    }
+    lockcpus(m);
+    portout(firstcpu(m), port, val);
+    unlockcpus(m);
+}
+
+/*
+ * devpos -- tell how far the program has read the device bound to a
+ * port
+ *
+ * m -- the computer
+ * port -- the port number
+ * return value -- the index of the next word of an array device, the
+ * byte offset in the file of an input stream device, or SIZE_MAX for
+ * devices whose position can't be restored, such as the console
+ */
+size_t devpos(struct machine *m, size_t port)
+{
+    struct device *d;
+    long pos;
+
+    initdevices(m);
+    d = &m->devices[port];
+    if(d->in == arrayin) return(d->pos);
+    if(d->f && d->in && ((pos = ftell(d->f)) != -1)) return(pos);
+    return(SIZE_MAX);
+}
+
+/*
+ * setdevpos -- move the device bound to a port to where devpos() said
+ * an earlier run of the program had read it to
+ *
+ * m -- the computer
+ * port -- the port number
+ * pos -- the position, or SIZE_MAX to leave the device alone
+ */
+void setdevpos(struct machine *m, size_t port, size_t pos)
+{
+    struct device *d;
+
+    initdevices(m);
+    d = &m->devices[port];
+    if(pos == SIZE_MAX) return;
+    if(d->in == arrayin)
+    {
+        if(pos > d->nwords) die("cannot restore position of input device");
+        d->pos = pos;
+    }
+    else if(d->f && d->in)
+    {
+        if(fseek(d->f, pos, SEEK_SET)) die("cannot restore position of input device");
+    }
+}
+
+/*
+ * freedevices -- close the devices of a computer and release its port
+ * table
+ *
+ * m -- the computer
+ */
+void freedevices(struct machine *m)
+{
+    size_t i;
+
+    if(!m->devices) return;
+    for(i=0; i<NPORTS; i++)
+        if(m->devices[i].close) m->devices[i].close(&m->devices[i]);
+    free(m->devices);
+    m->devices = 0;
+}
@@ -0,0 +1,21 @@
+/* I/O devices. Each port number that IN and OUT instructions can name
+ * is bound to a device, which is an instance of one of the backends
+ * in dev.c with its own state. */
+
+/* Count of port numbers */
+#define NPORTS 16
+
+/* Standard port numbers */
+#define CRT 0 /* display */
+#define KBD 1 /* keyboard */
+#define STDIN 6 /* standard input */
+#define STDOUT 7 /* standard output */
+
+struct machine;
+
+void bindport(struct machine *m, char *spec);
+word_t devin(struct machine *m, size_t port);
+void devout(struct machine *m, size_t port, word_t val);
+size_t devpos(struct machine *m, size_t port);
+void setdevpos(struct machine *m, size_t port, size_t pos);
+void freedevices(struct machine *m);
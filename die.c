@@ -1,10 +1,46 @@
 /* Routines for doing error-exits */
 
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "die.h"
 
+/* Where an error-exit jumps to instead of exiting the process, if
+ * somewhere up the call stack catchdie() is catching them. */
+static THREADLOCAL jmp_buf *trap;
+
+/* The message and exit status of the last error-exit caught by
+ * catchdie() */
+static THREADLOCAL char trapmsg[256];
+static THREADLOCAL int trapstatus;
+
+/* Function to call before an error-exit ends the process, or a null
+ * pointer */
+static void (*dying)(void);
+
+/*
+ * diestatus -- error-exit with the given exit status and message
+ *
+ * status -- the exit status
+ * msg -- the message
+ * s -- a string to append to the message, or a null pointer
+ */
+static void diestatus(int status, char *msg, char *s)
+{
+    if(trap)
+    {
+        if(s) snprintf(trapmsg, sizeof(trapmsg), "%s %s", msg, s);
+        else snprintf(trapmsg, sizeof(trapmsg), "%s", msg);
+        trapstatus = status;
+        longjmp(*trap, 1);
+    }
+    if(dying) dying();
+    if(s) fprintf(stderr, "error: %s %s\n", msg, s);
+    else fprintf(stderr, "error: %s\n", msg);
+    exit(status);
+}
+
 /*
  * die -- error-exit with the given message
  *
@@ -12,18 +48,83 @@
  */
 void die(char *msg)
 {
-    fprintf(stderr, "error: %s\n", msg);
-    exit(1);
+    dies(msg, 0);
 }
 
 /*
  * die -- error-exit with the given message
  *
  * msg -- the message
- * s -- a string to append to the message
+ * s -- a string to append to the message, or a null pointer
  */
 void dies(char *msg, char *s)
 {
-    fprintf(stderr, "error: %s %s\n", msg, s);
-    exit(1);
+    diestatus(1, msg, s);
+}
+
+/*
+ * dielimit -- error-exit because the program ran into a resource limit
+ *
+ * msg -- the message
+ *
+ * The exit status is LIMITSTATUS rather than 1, so that whoever runs
+ * ckone can tell a runaway program from a broken one.
+ */
+void dielimit(char *msg)
+{
+    diestatus(LIMITSTATUS, msg, 0);
+}
+
+/*
+ * ondie -- set a function to call before an error-exit ends the
+ * process, but not when catchdie() catches it
+ *
+ * fn -- the function, or a null pointer for none
+ *
+ * The function runs before the error message is printed, so it can
+ * write out output that belongs before the message.
+ */
+void ondie(void (*fn)(void))
+{
+    dying = fn;
+}
+
+/*
+ * catchdie -- call a function, catching its error-exits
+ *
+ * fn -- the function to call
+ * arg -- the argument to call it with
+ * return value -- a null pointer if fn returned normally, otherwise
+ * the message it died with. The message is overwritten by the next
+ * error-exit caught in the same thread.
+ *
+ * Anything fn had allocated when it died is leaked, and open files
+ * stay open; the caller must keep track of what needs cleaning up.
+ */
+char *catchdie(void (*fn)(void *), void *arg)
+{
+    jmp_buf buf;
+    jmp_buf *volatile outer;
+
+    outer = trap;
+    trap = &buf;
+    if(setjmp(buf))
+    {
+        trap = outer;
+        return(trapmsg);
+    }
+    fn(arg);
+    trap = outer;
+    return(0);
+}
+
+/*
+ * caughtstatus -- tell the exit status of the last error-exit caught by
+ * catchdie() in this thread
+ *
+ * return value -- 1, or LIMITSTATUS if it was done by dielimit()
+ */
+int caughtstatus(void)
+{
+    return(trapstatus);
 }
@@ -14,5 +14,27 @@
 # endif
 #endif
 
+/* Storage class for variables of which each thread has its own
+ * copy. This is standard only since C11, so older compilers need
+ * their own extensions. Leaving the definition blank makes it unsafe
+ * to simulate several computers at once. */
+#ifndef THREADLOCAL
+# if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#  define THREADLOCAL _Thread_local
+# elif defined(__GNUC__)
+#  define THREADLOCAL __thread
+# else
+#  define THREADLOCAL /* intentionally blank */
+# endif
+#endif
+
+/* Exit status of error-exits done by dielimit(), as opposed to 1 for
+ * all other errors */
+#define LIMITSTATUS 2
+
 void die(char *msg) NORETURN;
 void dies(char *msg, char *s) NORETURN;
+void dielimit(char *msg) NORETURN;
+void ondie(void (*fn)(void));
+char *catchdie(void (*fn)(void *), void *arg);
+int caughtstatus(void);
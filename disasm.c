@@ -1,63 +1,360 @@
-/* Disassembler. Prints disassembled TTK-91 instructions to standard
- * output. The disassembled instructions look a lot like TTK-91
- * assembler code, but since the assembly->bytecode->disassembly
- * translation loses some information, the instructions cannot be
- * presented in their original form as they appeared in the assembly
- * language source file.
+/* Disassembler. Prints disassembled TTK-91 instructions to the
+ * computer's output stream, normally standard output. The
+ * disassembled instructions look a lot like TTK-91 assembler code, but
+ * since the assembly->bytecode->disassembly translation loses some
+ * information, the instructions cannot be presented in their original
+ * form as they appeared in the assembly language source file.
  *
  * In the output, each instruction word is prefixed by its memory
- * address.
+ * address. Operands that are memory addresses are shown as the name
+ * of the symbol at that address, if there is one, written as in
+ * assembly language. Other operands show the addressing mode of the
+ * instruction word as it is: "=" for immediate, nothing for direct
+ * and "@" for indirect.
+ *
+ * Lines are formatted into a buffer with hand-written integer
+ * formatting instead of printf(), since whole images of millions of
+ * words are disassembled with disasmimage(), which also labels each
+ * word with the symbol at its address and shows the data area as DC
+ * words.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "die.h"
+#include "size.h"
+#include "word.h"
+#include "machine.h"
 #include "insn.h"
 #include "reg.h"
+#include "sym.h"
 #include "disasm.h"
 
+/* The decimal digits of 0 to 99, two per number, for formatting
+ * integers a pair of digits at a time */
+static const char digits2[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Size in bytes of the output buffer of disasmimage() */
+#define OUTBUFSIZE 65536
+
+/*
+ * putnum -- format an unsigned integer in decimal
+ *
+ * p -- where to write the digits
+ * val -- the integer
+ * return value -- the end of the digits written
+ */
+static char *putnum(char *p, size_t val)
+{
+    char tmp[24], *q = tmp + sizeof(tmp);
+    size_t len;
+
+    for(; val >= 100; val /= 100)
+    {
+        q -= 2;
+        memcpy(q, digits2 + 2*(val % 100), 2);
+    }
+    if(val >= 10)
+    {
+        q -= 2;
+        memcpy(q, digits2 + 2*val, 2);
+    }
+    else *--q = '0' + val;
+    len = tmp + sizeof(tmp) - q;
+    memcpy(p, q, len);
+    return(p + len);
+}
+
+/*
+ * putsigned -- format a signed integer in decimal
+ *
+ * p -- where to write the digits
+ * val -- the integer, as the two's complement representation of a
+ * signed one
+ * return value -- the end of the digits written
+ */
+static char *putsigned(char *p, size_t val)
+{
+    if((ssize_t)val >= 0) return(putnum(p, val));
+    *p++ = '-';
+    return(putnum(p, -val));
+}
+
+/*
+ * putname -- copy a symbol name or a mnemonic
+ *
+ * p -- where to write it
+ * s -- the name, of which at most DISASMSYM characters are copied
+ * return value -- the end of the characters written
+ */
+static char *putname(char *p, const char *s)
+{
+    size_t n;
+
+    for(n=0; s[n] && (n < DISASMSYM); n++) *p++ = s[n];
+    return(p);
+}
+
 /*
- * disasm -- disassemble instructions from a memory array.
+ * putaddr -- format the address column of a line as printf() would
+ * with "% 4zd: "
  *
- * words  -- the memory array
- * offset -- array index of first instruction
+ * p -- where to write it
+ * addr -- the address
+ * return value -- the end of the characters written
+ */
+static char *putaddr(char *p, size_t addr)
+{
+    char tmp[24];
+    size_t len, n;
+
+    len = putsigned(tmp, addr) - tmp;
+    for(n = len + (tmp[0] != '-'); n < 4; n++) *p++ = ' ';
+    if(tmp[0] != '-') *p++ = ' ';
+    memcpy(p, tmp, len);
+    p += len;
+    *p++ = ':';
+    *p++ = ' ';
+    return(p);
+}
+
+/*
+ * takesaddr -- tell whether an instruction is one of STORE, the jumps
+ * and CALL, whose operand in immediate mode is an address. In
+ * assembly language their operand is written with one level of
+ * indirection less than that of the other instructions.
+ */
+static int takesaddr(struct insn *insn)
+{
+    return((insn->opcode == 0x01) /*STORE*/
+           || ((insn->opcode >= 0x20) && (insn->opcode <= 0x2C)) /*JUMP..JNGRE*/
+           || (insn->opcode == 0x31)); /*CALL*/
+}
+
+/*
+ * inareas -- tell whether an address is in the code or data area.
+ * Only symbols there are labels.
+ */
+static int inareas(struct machine *m, size_t addr)
+{
+    return((addr - m->codeoff < m->codesize) || (addr - m->dataoff < m->datasize));
+}
+
+/*
+ * addrsym -- find the symbol to show in place of an instruction's
+ * operand
+ *
+ * m -- the computer
+ * at -- the symbol at each address of the computer's memory, or a
+ * null pointer to look symbols up in the symbol table
+ * insn -- the instruction
+ * return value -- the symbol table entry, or a null pointer if the
+ * operand is not a memory address or there is no symbol at it
+ *
+ * The operand is an address if it is fetched from memory (modes 1
+ * and 2), or if it is the target of a STORE or of a control transfer.
+ * Indexed operands are left alone, since the index is usually not a
+ * small offset from a symbol. Other immediate operands are plain
+ * numbers, even if some symbol happens to have the same value.
+ */
+static struct syment *addrsym(struct machine *m, struct syment **at, struct insn *insn)
+{
+    struct syment *ent;
+
+    if(insn->idxreg) return(0);
+    if((insn->mode == 0) && !takesaddr(insn)) return(0);
+    if(at) return((insn->imm < m->memsize) ? at[insn->imm] : 0);
+    if(!inareas(m, insn->imm)) return(0);
+    ent = nearestlabel(m, insn->imm);
+    return((ent && (ent->off == insn->imm)) ? ent : 0);
+}
+
+/*
+ * putinsn -- format an instruction, without its address
+ *
+ * p -- where to write it
+ * m -- the computer, for its symbols
+ * at -- as for addrsym()
+ * word -- the instruction word
+ * return value -- the end of the characters written
+ */
+static char *putinsn(char *p, struct machine *m, struct syment **at, size_t word)
+{
+    struct insn buf, *insn = &buf;
+    struct syment *ent;
+    size_t ind;
+
+    decode(insn, word);
+
+    /* Opcode mnemonic */
+    p = putname(p, insn->mnemonic);
+    *p++ = ' ';
+
+    /* Register */
+    if(insn->reg)
+    {
+        p = putname(p, regnames[insn->reg]);
+        *p++ = ',';
+        *p++ = ' ';
+    }
+
+    /* Operand given by a symbol, written as in assembly language, with
+     * ind levels of indirection. STORE, the jumps and CALL in mode 2
+     * would need two, which the assembler has no syntax for, so they
+     * are shown as numbers. */
+    ind = insn->mode + takesaddr(insn) - 1;
+    if((ind <= 1) && (ent = addrsym(m, at, insn)))
+    {
+        if(ind == 1) *p++ = '@';
+        return(putname(p, ent->sym));
+    }
+
+    /* Addressing mode */
+    if(insn->mode == 0) *p++ = '=';
+    else if(insn->mode == 2) *p++ = '@';
+
+    /* Operand */
+    if(insn->imm) p = putsigned(p, insn->imm);
+    if(insn->imm && insn->idxreg) *p++ = '(';
+    if(insn->idxreg) p = putname(p, regnames[insn->idxreg]);
+    if(insn->imm && insn->idxreg) *p++ = ')';
+    if(!insn->imm && !insn->idxreg) *p++ = '0';
+    return(p);
+}
+
+/*
+ * disasmline -- disassemble a single instruction word into a buffer
+ *
+ * m    -- the computer, for its symbols
+ * addr -- the address of the word
+ * word -- the instruction word
+ * buf  -- where to write the line, at least DISASMLINE bytes
+ * return value -- the length of the line
+ *
+ * The line is null-terminated and has no newline, and is the one
+ * disasmword() would print.
+ */
+size_t disasmline(struct machine *m, size_t addr, size_t word, char *buf)
+{
+    char *p;
+
+    p = putaddr(buf, addr);
+    p = putinsn(p, m, 0, word);
+    *p = 0;
+    return(p - buf);
+}
+
+/*
+ * disasmword -- disassemble a single instruction word
+ *
+ * m    -- the computer, for its symbols and output stream
+ * addr -- the address of the word
+ * word -- the instruction word
+ *
+ * The line is left without a newline, so that the caller can append
+ * to it.
+ */
+void disasmword(struct machine *m, size_t addr, size_t word)
+{
+    char buf[DISASMLINE];
+
+    fwrite(buf, 1, disasmline(m, addr, word, buf), m->out);
+}
+
+/*
+ * disasm -- disassemble instructions from a computer's memory.
+ *
+ * m      -- the computer
+ * offset -- address of first instruction
  * count  -- how many instruction words to disassemble
  */
-void disasm(size_t *words, size_t offset, size_t count)
+void disasm(struct machine *m, size_t offset, size_t count)
 {
-    struct insn *insn;
+    char buf[DISASMLINE];
+    size_t len;
 
     /* Each iteration of this loop disassembles a single instruction word. */
     for(; count; count--, offset++)
     {
-        /* Memory address */
-        printf("% 4zd: ", offset);
-
-        insn = decode(words[offset]);
-
-        /* Opcode mnemonic */
-        printf("%s ", insn->mnemonic);
+        len = disasmline(m, offset, m->mem[offset], buf);
+        buf[len++] = '\n';
+        fwrite(buf, 1, len, m->out);
+    }
+    fflush(m->out);
+}
 
-        /* Register */
-        if(insn->reg) printf("%s, ", regnames[insn->reg]);
+/*
+ * disasmimage -- disassemble a whole program with symbol labels
+ *
+ * m -- the computer, with the program loaded and not yet run
+ * f -- the stream to write the disassembly to
+ *
+ * The code area is shown as instructions and the data area as DC
+ * words. Each word is labelled with the symbol at its address, if
+ * there is one, in a column as wide as the longest such symbol.
+ * Symbols are looked up in a table indexed by address, built once.
+ */
+void disasmimage(struct machine *m, FILE *f)
+{
+    struct syment **at, *ent;
+    char *out, *p;
+    size_t i, width, len, addr, end;
 
-        /* Addressing mode */
-        if(insn->mode==0) 
-            printf("=");
-        else if(insn->mode==2)
-            printf("@");
+    /* The label of each address in the code and data areas: the first
+     * symbol added at it, as with nearestsym(), leaving out the
+     * predefined ones */
+    if(!(at = calloc(m->memsize ? m->memsize : 1, sizeof(*at)))) die("out of memory");
+    for(i=m->nsym; i; i--)
+    {
+        ent = &m->syms[i-1];
+        if(!inareas(m, ent->off) || (ent->off >= m->memsize) || ispredefined(ent)) continue;
+        at[ent->off] = ent;
+    }
+    width = 0;
+    for(i=0; i<m->nsym; i++)
+    {
+        ent = &m->syms[i];
+        if((ent->off < m->memsize) && (at[ent->off] == ent) && ((len = strlen(ent->sym)) > width)) width = len;
+    }
+    if(width > DISASMSYM) width = DISASMSYM;
 
-        /* Operand */
-        if(insn->imm && insn->idxreg)
-            printf("%zd(%s)", insn->imm, regnames[insn->idxreg]);
-        else if(insn->imm) 
-            printf("%zd", insn->imm);
-        else if(insn->idxreg)
-            printf("%s", regnames[insn->idxreg]);
+    if(!(out = malloc(OUTBUFSIZE))) die("out of memory");
+    p = out;
+    end = size_add(m->dataoff, m->datasize);
+    for(addr=m->codeoff; addr<end; addr++)
+    {
+        if((addr >= m->codeoff + m->codesize) && (addr < m->dataoff)) continue;
+        if(out + OUTBUFSIZE - p < DISASMLINE + 1)
+        {
+            fwrite(out, 1, p - out, f);
+            p = out;
+        }
+        p = putaddr(p, addr);
+        if(width)
+        {
+            len = at[addr] ? putname(p, at[addr]->sym) - p : 0;
+            for(p += len; len <= width; len++) *p++ = ' ';
+        }
+        if(addr < m->codeoff + m->codesize) p = putinsn(p, m, at, m->mem[addr]);
         else
-            printf("0");
-
-        printf("\n");
+        {
+            memcpy(p, "DC ", 3);
+            p = putsigned(p + 3, (sword_t)m->mem[addr]);
+        }
+        *p++ = '\n';
     }
-    fflush(stdout);
+    fwrite(out, 1, p - out, f);
+    fflush(f);
+    if(ferror(f)) die("cannot write disassembly");
+    free(out);
+    free(at);
 }
@@ -6,8 +6,30 @@
  * language source file.
  *
  * In the output, each instruction word is prefixed by its memory
- * address.
+ * address. Operands that are memory addresses are shown as the name
+ * of the symbol at that address, if there is one, written as in
+ * assembly language. Other operands show the addressing mode of the
+ * instruction word as it is: "=" for immediate, nothing for direct
+ * and "@" for indirect. <stdio.h> must be included before this
+ * header.
  */
 
-/* disasm -- disassemble instructions from a memory array. */
-void disasm(size_t *words, size_t offset, size_t count);
+/* Longest symbol name shown in full; longer ones are cut short */
+#define DISASMSYM 255
+
+/* Room in bytes that disasmline() needs for one line */
+#define DISASMLINE (2*DISASMSYM + 64)
+
+struct machine;
+
+/* disasmline -- disassemble a single instruction word into a buffer. */
+size_t disasmline(struct machine *m, size_t addr, size_t word, char *buf);
+
+/* disasmword -- disassemble a single instruction word. */
+void disasmword(struct machine *m, size_t addr, size_t word);
+
+/* disasm -- disassemble instructions from a computer's memory. */
+void disasm(struct machine *m, size_t offset, size_t count);
+
+/* disasmimage -- disassemble a whole program with symbol labels. */
+void disasmimage(struct machine *m, FILE *f);
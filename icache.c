@@ -0,0 +1,60 @@
+/* Pre-decoded instruction cache. Holds one pre-decoded instruction
+ * for each word of the simulated computer's memory, so that the
+ * simulator only has to decode an instruction word the first time it
+ * is fetched rather than every time. Entries are filled lazily by the
+ * simulator and invalidated by the memory module whenever the word
+ * they were decoded from is overwritten. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "insn.h"
+#include "icache.h"
+
+/*
+ * icache_resize -- grow the cache to cover the given number of words
+ *
+ * m -- the computer
+ * size -- the new size, never less than the current size
+ *
+ * New entries, as well as the entry past the end, are marked
+ * invalid. Dies if out of memory.
+ */
+void icache_resize(struct machine *m, size_t size)
+{
+    size = size_add(size, 1);
+    if(!(m->icache = realloc(m->icache, size_mul(size, sizeof(struct dinsn))))) die("out of memory");
+    memset(m->icache+m->icachesize, 0, (size-m->icachesize) * sizeof(struct dinsn));
+    m->icachesize = size;
+}
+
+/*
+ * icache_flush -- mark every entry in the cache invalid
+ *
+ * m -- the computer
+ */
+void icache_flush(struct machine *m)
+{
+    size_t i;
+
+    for(i=0; i<m->icachesize; i++) m->icache[i].valid = 0;
+}
+
+/*
+ * icache_free -- release the memory held by the cache
+ *
+ * m -- the computer
+ */
+void icache_free(struct machine *m)
+{
+    free(m->icache);
+    m->icache = 0;
+    m->icachesize = 0;
+}
@@ -0,0 +1,31 @@
+/* Pre-decoded instruction cache. Holds one pre-decoded instruction
+ * for each word of the simulated computer's memory, so that the
+ * simulator only has to decode an instruction word the first time it
+ * is fetched rather than every time. Entries are filled lazily by the
+ * simulator and invalidated by the memory module whenever the word
+ * they were decoded from is overwritten.
+ *
+ * The cache is the icache member of struct machine, parallel to the
+ * memory array: icache[addr] corresponds to mem[addr]. There is always
+ * one more entry than there are words of memory. That last entry is
+ * never valid, so an engine that runs off the end of memory takes the
+ * cache miss path, which checks the address. */
+
+/* Mark the entry for addr invalid, together with any entries whose
+ * fused handlers also execute the instruction at addr */
+#define ICACHE_INVALIDATE(ic, addr) \
+    do { \
+        struct dinsn *e_ = &(ic)[addr]; \
+        e_->valid = 0; \
+        if(e_->covered) \
+        { \
+            e_[-1].valid = 0; \
+            if(e_->covered > 1) e_[-2].valid = 0; \
+        } \
+    } while(0)
+
+struct machine;
+
+void icache_resize(struct machine *m, size_t size);
+void icache_flush(struct machine *m);
+void icache_free(struct machine *m);
@@ -0,0 +1,248 @@
+/* Binary program images. An image holds the same program as a .b91
+ * file, but in a form that can be loaded without parsing: a header,
+ * the code and data words as raw little-endian 64-bit words, and the
+ * symbol table with its names in a string table.
+ *
+ * All header fields and words are 64-bit little-endian numbers. The
+ * layout of an image file is
+ *
+ * offset 0: magic "CKONEIMG", then the version, codeoff, codesize,
+ * dataoff, datasize, the count of symbols and the size in bytes of
+ * the string table (together IMGHDRSIZE bytes)
+ * offset IMGHDRSIZE: codesize code words, followed by datasize data
+ * words
+ * then: for each symbol, the offset of its data word in memory and
+ * the offset of its name in the string table
+ * then: the string table, holding null-terminated symbol names
+ *
+ * Words are sign-extended to 64 bits, so that an image loads the same
+ * whatever the width of the simulated computer's words (see word.h).
+ * The loader maps the file into memory and copies the words straight
+ * into the simulated computer's memory, without conversion when the
+ * host is little-endian and the words are 64 bits wide. */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "sym.h"
+#include "parser.h"
+#include "image.h"
+
+/* The first bytes of every image file */
+#define IMGMAGIC "CKONEIMG"
+
+/* The version of the image format written by writeimage() */
+#define IMGVERSION 1
+
+/* Size in bytes of the header */
+#define IMGHDRSIZE (8*8)
+
+/*
+ * Byte order
+ */
+
+/*
+ * hostnative -- tell whether words are stored in an image exactly as
+ * they are in host memory
+ *
+ * return value -- nonzero if a word is a 64-bit little-endian number
+ */
+static int hostnative(void)
+{
+    word_t one = 1;
+
+    return((sizeof(word_t) == 8) && *(unsigned char *)&one);
+}
+
+/*
+ * put64 -- write a 64-bit little-endian number
+ *
+ * f -- the output stream
+ * val -- the number
+ */
+static void put64(FILE *f, uint64_t val)
+{
+    int i;
+
+    for(i=0; i<8; i++) putc((val >> (8*i)) & 0xff, f);
+}
+
+/*
+ * getword64 -- read a 64-bit little-endian number as a TTK-91 word
+ *
+ * p -- the first byte of the number
+ * return value -- the number, truncated to the width of a word
+ */
+static word_t getword64(const unsigned char *p)
+{
+    uint64_t val;
+    int i;
+
+    val = 0;
+    for(i=7; i>=0; i--) val = (val << 8) | p[i];
+    return(val);
+}
+
+/*
+ * get64 -- read a 64-bit little-endian number as a size
+ *
+ * p -- the first byte of the number
+ * return value -- the number
+ *
+ * Dies if the number doesn't fit in a size_t.
+ */
+static size_t get64(const unsigned char *p)
+{
+    uint64_t val;
+    int i;
+
+    val = 0;
+    for(i=7; i>=0; i--) val = (val << 8) | p[i];
+    if(val > SIZE_MAX) die("image number too large for this host");
+    return(val);
+}
+
+/*
+ * Writing
+ */
+
+/*
+ * writeimage -- write the program loaded into a computer as an image
+ *
+ * m -- the computer, with the program just loaded and not yet run
+ * filename -- the name of the image file to create
+ */
+void writeimage(struct machine *m, char *filename)
+{
+    size_t i, n, strsize;
+    FILE *f;
+
+    if(!(f = fopen(filename, "wb"))) dies("cannot open output file", filename);
+    strsize = 0;
+    for(i=0; i<m->nsym; i++) strsize = size_add(strsize, strlen(m->syms[i].sym)+1);
+
+    fwrite(IMGMAGIC, 1, 8, f);
+    put64(f, IMGVERSION);
+    put64(f, m->codeoff);
+    put64(f, m->codesize);
+    put64(f, m->dataoff);
+    put64(f, m->datasize);
+    put64(f, m->nsym);
+    put64(f, strsize);
+
+    n = m->codesize + m->datasize;
+    if(hostnative()) fwrite(m->mem + m->codeoff, sizeof(word_t), n, f);
+    else for(i=0; i<n; i++) put64(f, (sword_t)m->mem[m->codeoff + i]);
+
+    for(i=0, n=0; i<m->nsym; i++)
+    {
+        put64(f, m->syms[i].off);
+        put64(f, n);
+        n += strlen(m->syms[i].sym)+1;
+    }
+    for(i=0; i<m->nsym; i++) fwrite(m->syms[i].sym, 1, strlen(m->syms[i].sym)+1, f);
+
+    if(ferror(f)) die("cannot write to output file");
+    if(fclose(f)) die("cannot close output file");
+}
+
+/*
+ * Loading
+ */
+
+/*
+ * loadimage -- load an image into a computer's memory
+ *
+ * m -- the computer
+ * img -- the contents of the image file
+ * len -- the size in bytes of the image file
+ *
+ * Checks the image as strictly as the parser checks .b91 files.
+ */
+static void loadimage(struct machine *m, const unsigned char *img, size_t len)
+{
+    const unsigned char *words, *syms;
+    const char *strs;
+    size_t codeoff, codesize, dataoff, datasize, nsym, strsize;
+    size_t n, i, name, need;
+
+    if(get64(img+8) != IMGVERSION) die("unsupported image version");
+    codeoff = get64(img+16);
+    codesize = get64(img+24);
+    dataoff = get64(img+32);
+    datasize = get64(img+40);
+    nsym = get64(img+48);
+    strsize = get64(img+56);
+
+    /* The areas follow each other from the end of the memory, like in
+     * a .b91 file */
+    if(codeoff != m->memsize) die("bad code area offset in image");
+    if(dataoff != size_add(codeoff, codesize)) die("bad data area offset in image");
+    n = size_add(codesize, datasize);
+    need = size_add(IMGHDRSIZE, size_mul(n, 8));
+    need = size_add(need, size_mul(nsym, 16));
+    need = size_add(need, strsize);
+    if(need != len) die("image file has the wrong size");
+    words = img + IMGHDRSIZE;
+    syms = words + 8*n;
+    strs = (const char *)syms + 16*nsym;
+    if(strsize && strs[strsize-1]) die("bad string table in image");
+
+    addmem(m, n);
+    if(hostnative()) memcpy(m->mem + codeoff, words, n*8);
+    else for(i=0; i<n; i++) m->mem[codeoff + i] = getword64(words + 8*i);
+    m->codeoff = codeoff;
+    m->codesize = codesize;
+    m->dataoff = dataoff;
+    m->datasize = datasize;
+
+    for(i=0; i<nsym; i++)
+    {
+        name = get64(syms + 16*i + 8);
+        if(name >= strsize) die("bad symbol name in image");
+        addsym(m, (char *)strs + name, get64(syms + 16*i));
+    }
+}
+
+/*
+ * loadfile -- load a program into a computer's memory from either an
+ * image file or a .b91 file
+ *
+ * m -- the computer
+ * filename -- the name of the file. Images are told apart from .b91
+ * files by their first bytes, not by the name.
+ */
+void loadfile(struct machine *m, char *filename)
+{
+    struct stat st;
+    void *img;
+    int fd;
+
+    if((fd = open(filename, O_RDONLY)) == -1) die("cannot open input file");
+    if(fstat(fd, &st)) die("cannot read from input file");
+    img = MAP_FAILED;
+    if(st.st_size >= IMGHDRSIZE)
+        img = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if((img == MAP_FAILED) || memcmp(img, IMGMAGIC, 8))
+    {
+        if(img != MAP_FAILED) munmap(img, st.st_size);
+        parsefile(m, filename);
+        return;
+    }
+    loadimage(m, img, st.st_size);
+    munmap(img, st.st_size);
+}
@@ -0,0 +1,9 @@
+/* Binary program images. An image holds the same program as a .b91
+ * file, but in a form that can be loaded without parsing: a header,
+ * the code and data words as raw little-endian 64-bit words, and the
+ * symbol table with its names in a string table. */
+
+struct machine;
+
+void writeimage(struct machine *m, char *filename);
+void loadfile(struct machine *m, char *filename);
@@ -11,93 +11,98 @@
 #include <unistd.h>
 
 #include "die.h"
+#include "word.h"
 #include "insn.h"
 
-/* Represents one entry in the instruction table */
-struct insndef
+/* The instruction table, indexed by opcode. Unused opcodes are null
+ * pointers. */
+static char *const mnemonics[256] =
 {
-    size_t opcode;
-    char *mnemonic;
+    [0x00] = "NOP",
+    [0x01] = "STORE",
+    [0x02] = "LOAD",
+    [0x03] = "IN",
+    [0x04] = "OUT",
+    [0x11] = "ADD",
+    [0x12] = "SUB",
+    [0x13] = "MUL",
+    [0x14] = "DIV",
+    [0x15] = "MOD",
+    [0x16] = "AND",
+    [0x17] = "OR",
+    [0x18] = "XOR",
+    [0x19] = "SHL",
+    [0x1A] = "SHR",
+    [0x1B] = "SHRA",
+    [0x1F] = "COMP",
+    [0x20] = "JUMP",
+    [0x21] = "JNEG",
+    [0x22] = "JZER",
+    [0x23] = "JPOS",
+    [0x24] = "JNNEG",
+    [0x25] = "JNZER",
+    [0x26] = "JNPOS",
+    [0x27] = "JLES",
+    [0x28] = "JEQU",
+    [0x29] = "JGRE",
+    [0x2A] = "JNLES",
+    [0x2B] = "JNEQU",
+    [0x2C] = "JNGRE",
+    [0x31] = "CALL",
+    [0x32] = "EXIT",
+    [0x33] = "PUSH",
+    [0x34] = "POP",
+    [0x35] = "PUSHR",
+    [0x36] = "POPR",
+    [0x70] = "SVC",
 };
 
-/* The instruction table, sorted by opcode. */
-static struct insndef defs[] =
-{
-    {0x00, "NOP"},
-    {0x01, "STORE"},
-    {0x02, "LOAD"},
-    {0x03, "IN"},
-    {0x04, "OUT"},
-    {0x11, "ADD"},
-    {0x12, "SUB"},
-    {0x13, "MUL"},
-    {0x14, "DIV"},
-    {0x15, "MOD"},
-    {0x16, "AND"},
-    {0x17, "OR"},
-    {0x18, "XOR"},
-    {0x19, "SHL"},
-    {0x1A, "SHR"},
-    {0x1B, "SHRA"},
-    {0x1F, "COMP"},
-    {0x20, "JUMP"},
-    {0x21, "JNEG"},
-    {0x22, "JZER"},
-    {0x23, "JPOS"},
-    {0x24, "JNNEG"},
-    {0x25, "JNZER"},
-    {0x26, "JNPOS"},
-    {0x27, "JLES"},
-    {0x28, "JEQU"},
-    {0x29, "JGRE"},
-    {0x2A, "JNLES"},
-    {0x2B, "JNEQU"},
-    {0x2C, "JNGRE"},
-    {0x31, "CALL"},
-    {0x32, "EXIT"},
-    {0x33, "PUSH"},
-    {0x34, "POP"},
-    {0x35, "PUSHR"},
-    {0x36, "POPR"},
-    {0x70, "SVC"},
-};
-
-/* Count of entries in the instruction table */
-static const size_t ndefs = sizeof(defs) / sizeof(defs[0]);
-
-/* opcodemnemonic -- return an instruction's mnemonic given its opcode.
+/*
+ * opcodemnemonic -- return an instruction's mnemonic given its opcode
  *
  * opcode -- the opcode as disassembled from the instruction word
  * return value -- a string constant containing the mnemonic, or "" if
  * the opcode was unknown or invalid.
  */
-static char *opcodemnemonic(size_t opcode)
+char *opcodemnemonic(size_t opcode)
 {
-    struct insndef *def;
-
-    for(def=defs; def<defs+ndefs; def++)
-        if(def->opcode == opcode)
-            return(def->mnemonic);
-    return("");
+    if((opcode > 0xff) || !mnemonics[opcode]) return("");
+    return(mnemonics[opcode]);
 }
 
 /*
  * decode -- decode an instruction word
  *
+ * insn -- the structure to fill in; see comments in insn.h
  * word -- the instruction word to decode
- * return value -- a pointer to a statically allocated insn structure
- * corresponding to the instruction word; see comments in insn.h.
  */
-struct insn *decode(size_t word)
+void decode(struct insn *insn, size_t word)
 {
-    static struct insn buf; /* not re-entrant */
-    struct insn *insn = &buf;
-
     insn->opcode   = (word >> 24);
     insn->reg      = (word >> 21) & 7;
     insn->mode     = (word >> 19) & 3;
     insn->idxreg   = (word >> 16) & 7;
     insn->imm      = (ssize_t)(int16_t)(word & 0xffff);
     insn->mnemonic = opcodemnemonic(insn->opcode);
-    return(insn);
+}
+
+/*
+ * predecode -- decode an instruction word into a struct dinsn
+ *
+ * d -- the structure to fill in; marked valid upon return
+ * word -- the instruction word to decode
+ *
+ * Unlike decode(), this does not look up the mnemonic, so it is cheap
+ * enough for the simulator to call on every instruction cache miss.
+ */
+void predecode(struct dinsn *d, size_t word)
+{
+    /* Words too wide to hold a valid opcode in the low byte map to
+     * 0xff, which is not a valid opcode either. */
+    d->opcode = ((word >> 24) > 0xff) ? 0xff : (word >> 24);
+    d->reg    = (word >> 21) & 7;
+    d->mode   = (word >> 19) & 3;
+    d->idxreg = (word >> 16) & 7;
+    d->imm    = (sword_t)(int16_t)(word & 0xffff);
+    d->valid  = 1;
 }
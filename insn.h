@@ -3,7 +3,7 @@
  * disassembler and the simulator to split an instruction word into
  * its component parts as explained in the Titokone manual and the
  * slides of the University of Helsinki "Tietokoneen toiminta"
- * course. */
+ * course. "word.h" must be included before this header. */
 
 /* The decoded form of a single instruction */
 struct insn
@@ -17,5 +17,29 @@ struct insn
     char *mnemonic; /* mnemonic string or "" if invalid */
 };
 
+/* The pre-decoded form of a single instruction, as kept in the
+ * simulator's instruction cache. It has the same fields as struct
+ * insn minus the mnemonic, which only the disassembler needs, packed
+ * into as few bytes as possible. */
+struct dinsn
+{
+    void *handler; /* handler address, used only by the threaded engine */
+    word_t imm; /* sign-extended immediate value or address */
+    unsigned char opcode;
+    unsigned char reg; /* main register (Ri) */
+    unsigned char mode; /* addressing mode, as in struct insn */
+    unsigned char idxreg; /* index register (Rj) or zero if none */
+    unsigned char valid; /* nonzero if the fields above are up to date */
+    unsigned char covered; /* how many words back the furthest entry
+                            * whose fused handler also executes this
+                            * instruction may be, see threaded.c */
+};
+
+/* opcodemnemonic -- return the mnemonic of an opcode, or "" */
+char *opcodemnemonic(size_t opcode);
+
 /* decode -- decode an instruction word */
-struct insn *decode(size_t word);
+void decode(struct insn *insn, size_t word);
+
+/* predecode -- decode an instruction word into a struct dinsn */
+void predecode(struct dinsn *d, size_t word);
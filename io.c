@@ -0,0 +1,230 @@
+/* Streams of the I/O devices. In interactive mode the devices read
+ * and write the computer's streams a word at a time, flushing the
+ * output before every read so that prompts show up. In buffered mode,
+ * for input that comes from a file or a pipe, the input is read and
+ * parsed in one go the first time the program asks for a word, and
+ * the output is collected in a buffer that is written only when it
+ * fills up or the program halts, so that a program doing a lot of I/O
+ * costs a few system calls rather than one per word. */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "io.h"
+
+/* Initial size in bytes of the output buffer */
+#define OUTBUFMIN 4096
+
+/* The output buffer grows up to this size in bytes before it is
+ * written out */
+#define OUTBUFMAX (1024*1024)
+
+/* The computer whose buffered output is to be written if an
+ * error-exit ends the process while it runs */
+static struct machine *exiting;
+
+/*
+ * startio -- choose how a computer's I/O devices use its streams
+ *
+ * m -- the computer
+ * buffered -- nonzero for buffered mode, zero for interactive mode
+ */
+void startio(struct machine *m, int buffered)
+{
+    m->buffered = buffered;
+}
+
+/*
+ * flushio -- write the buffered output to the computer's output stream
+ * and flush the stream
+ *
+ * m -- the computer
+ */
+void flushio(struct machine *m)
+{
+    if(m->outlen) fwrite(m->outbuf, 1, m->outlen, m->out);
+    m->outlen = 0;
+    fflush(m->out);
+}
+
+/*
+ * writeondie -- ondie() handler writing the output of a run that ends
+ * in an error-exit, so that it is not lost and comes before the error
+ * message
+ */
+static void writeondie(void)
+{
+    struct machine *m = exiting;
+
+    exiting = 0;
+    if(m) flushio(m);
+}
+
+/*
+ * flushondie -- arrange for the buffered output of a computer to be
+ * written if an error-exit ends the process before the computer halts
+ *
+ * m -- the computer, or a null pointer once it no longer exists
+ */
+void flushondie(struct machine *m)
+{
+    exiting = m;
+    ondie(m ? writeondie : 0);
+}
+
+/*
+ * append -- add bytes to the output buffer
+ *
+ * m -- the computer
+ * s -- the bytes
+ * n -- count of bytes
+ */
+static void append(struct machine *m, char *s, size_t n)
+{
+    size_t cap;
+
+    if(m->outlen + n > m->outcap)
+    {
+        for(cap = m->outcap ? m->outcap : OUTBUFMIN; (cap < m->outlen+n) && (cap < OUTBUFMAX); cap = size_mul(cap, 2));
+        if(cap > m->outcap)
+        {
+            if(!(m->outbuf = realloc(m->outbuf, cap))) die("out of memory");
+            m->outcap = cap;
+        }
+        if(m->outlen + n > m->outcap) flushio(m);
+    }
+    memcpy(m->outbuf + m->outlen, s, n);
+    m->outlen += n;
+}
+
+/*
+ * putstr -- write a string to the computer's output
+ *
+ * m -- the computer
+ * s -- the string, at most OUTBUFMIN bytes long
+ */
+void putstr(struct machine *m, char *s)
+{
+    if(!m->buffered) fputs(s, m->out);
+    else append(m, s, strlen(s));
+}
+
+/*
+ * putword -- write a word to the computer's output as a signed decimal
+ * integer
+ *
+ * m -- the computer
+ * val -- the unsigned word representation of the integer
+ */
+void putword(struct machine *m, word_t val)
+{
+    char buf[32], *p;
+    word_t u;
+
+    if(!m->buffered)
+    {
+        fprintf(m->out, "%zd", (ssize_t)(sword_t)val);
+        return;
+    }
+    p = buf + sizeof(buf);
+    u = ((sword_t)val < 0) ? -val : val;
+    do *--p = '0' + u%10; while(u /= 10);
+    if((sword_t)val < 0) *--p = '-';
+    append(m, p, buf+sizeof(buf)-p);
+}
+
+/*
+ * readinput -- read the whole input stream and parse it into words
+ *
+ * m -- the computer
+ *
+ * The words are parsed like fscanf() with %zd would parse them, up to
+ * the first thing that isn't a signed decimal integer. Integer
+ * overflow checking not done.
+ */
+static void readinput(struct machine *m)
+{
+    char *buf = 0, *p;
+    size_t len = 0, cap = 0, n, u;
+    int neg;
+
+    for(;;)
+    {
+        if(len == cap)
+        {
+            cap = cap ? size_mul(cap, 2) : BUFSIZ;
+            if(!(buf = realloc(buf, cap+1))) die("out of memory");
+        }
+        if(!(n = fread(buf+len, 1, cap-len, m->in))) break;
+        len += n;
+    }
+    if(ferror(m->in)) die("cannot read from standard input");
+    buf[len] = 0;
+
+    for(p = buf;;)
+    {
+        while(isspace((unsigned char)*p)) p++;
+        neg = (*p == '-');
+        if((*p == '-') || (*p == '+')) p++;
+        if(!isdigit((unsigned char)*p)) break;
+        for(u = 0; isdigit((unsigned char)*p); p++) u = u*10 + (*p-'0');
+        if(m->ninput == m->inputcap)
+        {
+            m->inputcap = m->inputcap ? size_mul(m->inputcap, 2) : 64;
+            if(!(m->input = realloc(m->input, size_mul(m->inputcap, sizeof(word_t))))) die("out of memory");
+        }
+        m->input[m->ninput++] = neg ? -u : u;
+    }
+    free(buf);
+    m->inputread = 1;
+}
+
+/*
+ * getword -- read a signed decimal integer from the computer's input
+ *
+ * m -- the computer
+ * out_val -- pointer to output parameter into which the unsigned word
+ * representation of the integer is stored
+ * return value -- nonzero on success, zero at the end of the input or
+ * if the input isn't an integer
+ */
+int getword(struct machine *m, word_t *out_val)
+{
+    ssize_t ss;
+
+    if(!m->buffered)
+    {
+        if(fscanf(m->in, "%zd", &ss) != 1) return(0);
+        *out_val = ss;
+        return(!ferror(m->in));
+    }
+    if(!m->inputread) readinput(m);
+    if(m->inputpos == m->ninput) return(0);
+    *out_val = m->input[m->inputpos++];
+    return(1);
+}
+
+/*
+ * freeio -- release the buffers of a computer's I/O devices. Any
+ * output still in the buffer is thrown away.
+ *
+ * m -- the computer
+ */
+void freeio(struct machine *m)
+{
+    free(m->outbuf);
+    free(m->input);
+    m->outbuf = 0;
+    m->input = 0;
+    m->outlen = m->outcap = 0;
+    m->ninput = m->inputcap = m->inputpos = 0;
+    m->inputread = 0;
+}
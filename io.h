@@ -0,0 +1,14 @@
+/* Streams of the I/O devices. In interactive mode the devices read
+ * and write the computer's streams a word at a time; in buffered mode
+ * the input is read in one go and the output is collected in a buffer
+ * that is written when it fills up or the program halts. */
+
+struct machine;
+
+void startio(struct machine *m, int buffered);
+void flushio(struct machine *m);
+void flushondie(struct machine *m);
+void putstr(struct machine *m, char *s);
+void putword(struct machine *m, word_t val);
+int getword(struct machine *m, word_t *out_val);
+void freeio(struct machine *m);
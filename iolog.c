@@ -0,0 +1,278 @@
+/* I/O log. Records the words a program reads from and writes to its
+ * devices, and when it halts, so that the run can be replayed later
+ * without its input devices, checking that it writes the same
+ * output.
+ *
+ * Input and output are the only things in a run that don't follow
+ * from the program itself: the supervisor calls that read and write
+ * go through the devices, and TIME and DATE are not implemented. So a
+ * replayed run takes the words it reads from the log instead of its
+ * devices, which are never touched and print no prompts, and does the
+ * same thing as the recorded run, instruction for instruction. Each
+ * word written and the halt are checked against the log as they
+ * happen, and the run dies at the first difference. Only IN, OUT and
+ * SVC go through the log, so the program runs at the full speed of
+ * whichever engine runs it.
+ *
+ * A log file is the magic "CKONEIOL" followed by one event per word
+ * read or written and one for the halt. An event is a byte holding the
+ * kind of event and the port, then the count of instructions executed
+ * since the previous event, then for reads and writes the word. The
+ * numbers are variable-length: seven bits per byte, least significant
+ * first, with the top bit set in all bytes but the last. Words are
+ * sign-extended and then zigzag-encoded so that small negative numbers
+ * are short too, and so that logs can be replayed with either word
+ * width. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "iolog.h"
+
+/* The first bytes of every log file */
+#define LOGMAGIC "CKONEIOL"
+
+/* Kinds of events, in the low bits of the first byte of an event; the
+ * port is in the bits above */
+#define EV_IN 0 /* a word read from a port */
+#define EV_OUT 1 /* a word written to a port */
+#define EV_HALT 2 /* the HALT supervisor call */
+#define EV_KINDBITS 2
+
+/* An open log */
+struct iolog
+{
+    FILE *f;
+    int replay; /* nonzero if replaying, zero if recording */
+    size_t last; /* instructions retired at the previous event */
+};
+
+/*
+ * putvar -- write a variable-length number to a log
+ *
+ * f -- the log file
+ * val -- the number
+ */
+static void putvar(FILE *f, uint64_t val)
+{
+    for(; val >= 0x80; val >>= 7) putc((int)(val & 0x7f) | 0x80, f);
+    putc((int)val, f);
+}
+
+/*
+ * getvar -- read a variable-length number from a log
+ *
+ * f -- the log file
+ * return value -- the number
+ */
+static uint64_t getvar(FILE *f)
+{
+    uint64_t val = 0;
+    int shift, ch;
+
+    for(shift = 0; shift < 64; shift += 7)
+    {
+        if((ch = getc(f)) == EOF) die("truncated replay log");
+        val |= (uint64_t)(ch & 0x7f) << shift;
+        if(!(ch & 0x80)) return(val);
+    }
+    die("bad number in replay log");
+    return(0);
+}
+
+/*
+ * openlog -- open a log file and attach it to a computer
+ *
+ * m -- the computer
+ * filename -- the name of the log file
+ * replay -- nonzero to replay the log, zero to record it
+ */
+static void openlog(struct machine *m, char *filename, int replay)
+{
+    struct iolog *l;
+    char magic[8];
+
+    if(!(l = calloc(1, sizeof(*l)))) die("out of memory");
+    if(!(l->f = fopen(filename, replay ? "rb" : "wb"))) dies("cannot open replay log", filename);
+    l->replay = replay;
+    l->last = m->retired;
+    if(!replay) fwrite(LOGMAGIC, 1, 8, l->f);
+    else if((fread(magic, 1, 8, l->f) != 8) || memcmp(magic, LOGMAGIC, 8)) die("not a replay log");
+    m->iolog = l;
+}
+
+/*
+ * startrecord -- start recording the I/O of a computer
+ *
+ * m -- the computer
+ * filename -- the name of the log file to write
+ *
+ * The log is written as the program runs, so that it is complete up
+ * to the point where the run ends even if it ends in an error-exit.
+ */
+void startrecord(struct machine *m, char *filename)
+{
+    openlog(m, filename, 0);
+}
+
+/*
+ * startreplay -- start replaying a recorded run on a computer
+ *
+ * m -- the computer, with the program of the recorded run loaded
+ * filename -- the name of the log file
+ */
+void startreplay(struct machine *m, char *filename)
+{
+    openlog(m, filename, 1);
+}
+
+/*
+ * replaying -- tell whether a computer is replaying a recorded run
+ *
+ * m -- the computer
+ * return value -- nonzero if it is
+ */
+int replaying(struct machine *m)
+{
+    return(m->iolog && m->iolog->replay);
+}
+
+/*
+ * diverged -- die because a replayed run does something other than
+ * the recorded one did
+ *
+ * m -- the computer
+ * what -- what the replayed run does
+ */
+static void diverged(struct machine *m, char *what)
+{
+    char msg[96];
+
+    sprintf(msg, "replay diverged at instruction %zu:", m->retired);
+    dies(msg, what);
+}
+
+/*
+ * putevent -- write an event to the log being recorded
+ *
+ * m -- the computer
+ * kind -- EV_IN, EV_OUT or EV_HALT
+ * port -- the port, zero for EV_HALT; devin() and devout() have
+ * checked that it is below NPORTS, so it fits in the event byte
+ * val -- the word read or written, ignored for EV_HALT
+ */
+static void putevent(struct machine *m, int kind, size_t port, word_t val)
+{
+    struct iolog *l = m->iolog;
+
+    putc(kind | (int)(port << EV_KINDBITS), l->f);
+    putvar(l->f, m->retired - l->last);
+    if(kind != EV_HALT)
+    {
+        /* Zigzag encoding of the sign-extended word */
+        int64_t s = (sword_t)val;
+        putvar(l->f, ((uint64_t)s << 1) ^ (s < 0 ? UINT64_MAX : 0));
+    }
+    if(ferror(l->f)) die("cannot write to replay log");
+    l->last = m->retired;
+}
+
+/*
+ * getevent -- read the next event of the log being replayed and check
+ * that the replayed run has come to it
+ *
+ * m -- the computer
+ * kind -- the kind of event the replayed run is doing
+ * port -- its port, zero for EV_HALT, below NPORTS as for putevent()
+ * what -- how to describe the event if the run has diverged
+ * return value -- the word of the event, or zero for EV_HALT
+ */
+static word_t getevent(struct machine *m, int kind, size_t port, char *what)
+{
+    struct iolog *l = m->iolog;
+    uint64_t u;
+    int ch;
+
+    if((ch = getc(l->f)) == EOF) diverged(m, what);
+    if((ch != (kind | (int)(port << EV_KINDBITS))) || (getvar(l->f) != m->retired - l->last))
+        diverged(m, what);
+    l->last = m->retired;
+    if(kind == EV_HALT) return(0);
+    u = getvar(l->f);
+    return((word_t)(int64_t)((u >> 1) ^ -(u & 1)));
+}
+
+/*
+ * replayin -- read a word from a port of a computer replaying a run
+ *
+ * m -- the computer
+ * port -- the port number
+ * return value -- the word the recorded run read
+ */
+word_t replayin(struct machine *m, size_t port)
+{
+    return(getevent(m, EV_IN, port, "reads input the recorded run did not"));
+}
+
+/*
+ * login -- log a word read from a port
+ *
+ * m -- the computer, recording
+ * port -- the port number
+ * val -- the word
+ */
+void login(struct machine *m, size_t port, word_t val)
+{
+    putevent(m, EV_IN, port, val);
+}
+
+/*
+ * logout -- record a word written to a port, or check it against the
+ * recorded run
+ *
+ * m -- the computer
+ * port -- the port number
+ * val -- the word
+ */
+void logout(struct machine *m, size_t port, word_t val)
+{
+    if(!m->iolog->replay) putevent(m, EV_OUT, port, val);
+    else if(getevent(m, EV_OUT, port, "writes output the recorded run did not") != val)
+        diverged(m, "writes different output");
+}
+
+/*
+ * loghalt -- record the HALT supervisor call, or check it against the
+ * recorded run
+ *
+ * m -- the computer
+ */
+void loghalt(struct machine *m)
+{
+    if(!m->iolog->replay) putevent(m, EV_HALT, 0, 0);
+    else getevent(m, EV_HALT, 0, "halts where the recorded run did not");
+}
+
+/*
+ * endiolog -- stop recording or replaying and close the log
+ *
+ * m -- the computer
+ *
+ * Dies if a replayed run has ended before the recorded one did.
+ */
+void endiolog(struct machine *m)
+{
+    struct iolog *l = m->iolog;
+
+    if(!l) return;
+    if(l->replay && (getc(l->f) != EOF)) die("replay ended before the recorded run");
+    if(fclose(l->f)) die("cannot close replay log");
+    free(l);
+    m->iolog = 0;
+}
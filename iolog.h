@@ -0,0 +1,15 @@
+/* I/O log. Records the words a program reads from and writes to its
+ * devices, and when it halts, so that the run can be replayed later
+ * without its input devices, checking that it writes the same
+ * output. "word.h" must be included before this header. */
+
+struct machine;
+
+void startrecord(struct machine *m, char *filename);
+void startreplay(struct machine *m, char *filename);
+int replaying(struct machine *m);
+word_t replayin(struct machine *m, size_t port);
+void login(struct machine *m, size_t port, word_t val);
+void logout(struct machine *m, size_t port, word_t val);
+void loghalt(struct machine *m);
+void endiolog(struct machine *m);
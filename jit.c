@@ -0,0 +1,836 @@
+/* Just-in-time compiler for x86-64 hosts. Runs the program like
+ * simulate() does, but translates the hot basic blocks of the code
+ * area into native machine code.
+ *
+ * A basic block starts at any instruction the engine reaches and
+ * extends up to and including the first JUMP, Jxx, CALL or EXIT. It
+ * stops short of any instruction the translator doesn't handle, such
+ * as IN, OUT, SVC, DIV and MOD, which are left to the interpreter, so
+ * all I/O goes through the same code as in the reference engine.
+ * Blocks never extend outside the code area.
+ *
+ * Inside a block the general purpose registers R0..R7 live in the host
+ * registers r8..r15. The memory array is addressed through rbx and
+ * its size is kept in rbp. Arithmetic on words is done at the width of
+ * a word (see word.h), so with 32-bit words the host registers hold
+ * zero-extended 32-bit values, which can be used as addresses as is.
+ * Every memory access is bounds-checked; an access that would fail, as
+ * well as any store into the code area, leaves the block through a
+ * side exit just before the offending instruction. The interpreter
+ * then executes that instruction, dying with the usual message or
+ * letting setmem() count the store into the code area, upon which all
+ * translations are thrown away. Stores that go ahead mark their page
+ * in the dirty map (see mem.h), which is reached through rdi, since
+ * that points at the registers inside struct machine.
+ *
+ * The instruction register is not kept up to date inside blocks. Each
+ * block returns how many instructions it executed, and the resource
+ * limits are checked between blocks. */
+
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "reg.h"
+#include "insn.h"
+#include "sim.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+/* Size in bytes of the buffer holding translated code */
+#define CODEBUFSIZE (4*1024*1024)
+
+/* Maximum count of instructions in one block */
+#define MAXBLOCKLEN 64
+
+/* Upper bounds of the sizes in bytes of the code written by the
+ * emitters below. A register-register instruction may have a two-byte
+ * opcode, and a constant may need a 64-bit move. */
+#define RRBYTES 4 /* emitrr(), emitrex() */
+#define RIBYTES 7 /* emitri() */
+#define MOVIMMBYTES 10 /* emitmovimm() */
+#define DISPBYTES 7 /* emitdisp() */
+#define MEMBYTES 4 /* emitmem() */
+#define SHIFTBYTES 4 /* emitshift() */
+#define SETCCBYTES 6 /* emitsetcc() */
+#define MARKDIRTYBYTES 17 /* markdirty() */
+
+/* A side exit is a conditional jump in the block plus the code after
+ * the epilogue that it jumps to, loading two constants and jumping to
+ * the epilogue (see translate()). */
+#define SIDEEXITBYTES (6 + 2*MOVIMMBYTES + 5)
+#define CHECKADDRBYTES (RRBYTES + SIDEEXITBYTES)
+#define CHECKSTOREBYTES (CHECKADDRBYTES + RRBYTES + 2*RIBYTES + SIDEEXITBYTES + MARKDIRTYBYTES)
+#define OPERANDBYTES (RRBYTES + RIBYTES + 2*(CHECKADDRBYTES + MEMBYTES))
+
+/* Upper bound of the size of the code for an instruction other than
+ * the last one of a block. PUSH with an indirect operand is the
+ * longest. */
+#define MAXINSNBYTES (OPERANDBYTES + 2*RRBYTES + RIBYTES + CHECKSTOREBYTES + MEMBYTES)
+
+/* Upper bound of the size of the code for the last instruction of a
+ * block. EXIT popping the most parameters translatable() allows is the
+ * longest, checking ten addresses. */
+#define MAXLASTBYTES (RRBYTES + 10*(CHECKADDRBYTES + RIBYTES) + 2*MEMBYTES + 2*RIBYTES)
+
+/* Upper bound of the size in bytes of a translated block, used to
+ * check whether the code buffer has room for another block. The
+ * prologue and the epilogue take less than 256 bytes. */
+#define MAXBLOCKBYTES ((MAXBLOCKLEN-1)*MAXINSNBYTES + MAXLASTBYTES + 256)
+
+/* How many times the engine must reach an address before the block
+ * starting there is translated. */
+#define HOT 16
+
+/* Heat value of an address at which no block can be translated */
+#define NEVER 255
+
+/* Host register numbers as used in x86-64 instruction encodings */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+
+/* The host register holding general purpose register g */
+#define HOSTREG(g) (8+(g))
+
+/* Condition codes for Jcc, SETcc and CMOVcc instructions */
+#define CC_B  0x2 /* below */
+#define CC_AE 0x3 /* above or equal */
+#define CC_E  0x4 /* equal */
+#define CC_NE 0x5 /* not equal */
+#define CC_A  0x7 /* above */
+#define CC_S  0x8 /* sign */
+#define CC_NS 0x9 /* not sign */
+#define CC_L  0xC /* less */
+#define CC_LE 0xE /* less or equal */
+#define CC_G  0xF /* greater */
+
+/* Condition codes for the less and greater results of COMP, which are
+ * signed or unsigned depending on the word width (see WORD_LT()) */
+#if WORDBITS == 32
+#define CC_LESS CC_L
+#define CC_MORE CC_G
+#else
+#define CC_LESS CC_B
+#define CC_MORE CC_A
+#endif
+
+/* REX prefix of instructions operating on words, and the scale factor
+ * field of a SIB byte addressing an array of words */
+#if WORDBITS == 32
+#define REXWORD 0x40
+#define SIBWORD 0x80
+#else
+#define REXWORD 0x48
+#define SIBWORD 0xC0
+#endif
+
+/* What a translated block returns, in rax and rdx */
+struct jitexit
+{
+    size_t pc; /* address of the next instruction to execute */
+    size_t count; /* count of instructions executed, plus SIDE if the
+                   * interpreter must execute the next one */
+};
+
+/* Flag of the count of a side exit */
+#define SIDE ((size_t)1 << 63)
+
+/* A translated block. Arguments are the register array, the state
+ * register, the memory array and the memory size. */
+typedef struct jitexit (*block_t)(word_t *, word_t *, word_t *, size_t);
+
+/* A jump to a side exit whose target is not yet known */
+struct fixup
+{
+    unsigned char *at; /* where the rel32 displacement goes */
+    size_t pc; /* guest address to exit with */
+};
+
+/* The translator's state is per thread, since each thread of a batch
+ * run (see batch.c) simulates its own computer. */
+
+/* The code buffer, and the first free byte in it. The buffer is kept
+ * for the next run in the same thread. */
+static THREADLOCAL unsigned char *codebuf;
+static THREADLOCAL unsigned char *cp;
+
+/* Translated blocks and heat counters, indexed by address relative
+ * to the start of the code area */
+static THREADLOCAL block_t *blocks;
+static THREADLOCAL unsigned char *heat;
+
+/* Side exits of the block being translated */
+static THREADLOCAL struct fixup fixups[MAXBLOCKLEN*8];
+static THREADLOCAL size_t nfixups;
+
+/*
+ * Instruction encoding
+ */
+
+static void emit1(int byte)
+{
+    *cp++ = byte;
+}
+
+static void emit4(uint32_t word)
+{
+    memcpy(cp, &word, 4);
+    cp += 4;
+}
+
+static void emit8(uint64_t word)
+{
+    memcpy(cp, &word, 8);
+    cp += 8;
+}
+
+/*
+ * emitrex -- emit an instruction with a register-register ModRM
+ *
+ * rex -- the REX prefix, without the bits for the registers
+ * op -- the opcode, with 0x0F in the high byte for two-byte opcodes
+ * reg -- the register in the reg field
+ * rm -- the register in the r/m field
+ */
+static void emitrex(int rex, int op, int reg, int rm)
+{
+    emit1(rex | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+    if(op > 0xff) emit1(op >> 8);
+    emit1(op & 0xff);
+    emit1(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/*
+ * emitrr -- emit an instruction operating on words with a
+ * register-register ModRM, as in emitrex()
+ */
+static void emitrr(int op, int reg, int rm)
+{
+    emitrex(REXWORD, op, reg, rm);
+}
+
+/*
+ * emitri -- emit a group 1 instruction operating on words with an
+ * immediate operand, such as ADD r/m64, imm32
+ *
+ * ext -- the opcode extension: 0=ADD 1=OR 4=AND 5=SUB 6=XOR 7=CMP
+ * rm -- the destination register
+ * imm -- the immediate, sign-extended from 32 bits
+ */
+static void emitri(int ext, int rm, int32_t imm)
+{
+    emit1(REXWORD | ((rm & 8) >> 3));
+    emit1(0x81);
+    emit1(0xC0 | (ext << 3) | (rm & 7));
+    emit4(imm);
+}
+
+/*
+ * emitmovimm -- emit an instruction loading a 64-bit constant into a
+ * register
+ */
+static void emitmovimm(int reg, size_t imm)
+{
+    if((ssize_t)imm == (int32_t)imm)
+    {
+        /* MOV r/m64, imm32 */
+        emit1(0x48 | ((reg & 8) >> 3));
+        emit1(0xC7);
+        emit1(0xC0 | (reg & 7));
+        emit4(imm);
+    }
+    else
+    {
+        /* MOV r64, imm64 */
+        emit1(0x48 | ((reg & 8) >> 3));
+        emit1(0xB8 | (reg & 7));
+        emit8(imm);
+    }
+}
+
+/*
+ * emitdisp -- emit an instruction operating on words with a
+ * [base+disp32] operand
+ *
+ * op -- the opcode
+ * reg -- the register in the reg field
+ * base -- the base register; must not be rsp or r12
+ * disp -- the displacement
+ */
+static void emitdisp(int op, int reg, int base, int32_t disp)
+{
+    emit1(REXWORD | ((reg & 8) >> 1) | ((base & 8) >> 3));
+    emit1(op);
+    emit1(0x80 | ((reg & 7) << 3) | (base & 7));
+    emit4(disp);
+}
+
+/*
+ * emitmem -- emit an instruction with a [rbx+idx*sizeof(word_t)]
+ * operand, that is, an access to the memory word whose address is in
+ * idx
+ *
+ * op -- the opcode, 0x8B for loads and 0x89 for stores
+ * reg -- the register in the reg field
+ * idx -- the register holding the word address
+ */
+static void emitmem(int op, int reg, int idx)
+{
+    emit1(REXWORD | ((reg & 8) >> 1) | ((idx & 8) >> 2));
+    emit1(op);
+    emit1(0x04 | ((reg & 7) << 3));
+    emit1(SIBWORD | ((idx & 7) << 3) | RBX);
+}
+
+/*
+ * emitshift -- emit a shift of a word in a register by a constant
+ *
+ * ext -- the opcode extension: 4=SHL 5=SHR 7=SAR
+ */
+static void emitshift(int ext, int rm, int nbits)
+{
+    emit1(REXWORD | ((rm & 8) >> 3));
+    emit1(0xC1);
+    emit1(0xC0 | (ext << 3) | (rm & 7));
+    emit1(nbits);
+}
+
+/*
+ * emitsetcc -- emit SETcc on the low byte of rax, rcx or rdx and
+ * zero-extend it to the full register
+ */
+static void emitsetcc(int cc, int reg)
+{
+    emit1(0x0F);
+    emit1(0x90 | cc);
+    emit1(0xC0 | reg);
+    emit1(0x0F); /* MOVZX r32, r/m8 */
+    emit1(0xB6);
+    emit1(0xC0 | (reg << 3) | reg);
+}
+
+static void emitpush(int reg)
+{
+    if(reg & 8) emit1(0x41);
+    emit1(0x50 | (reg & 7));
+}
+
+static void emitpop(int reg)
+{
+    if(reg & 8) emit1(0x41);
+    emit1(0x58 | (reg & 7));
+}
+
+/*
+ * sideexit -- emit a conditional jump to a side exit
+ *
+ * cc -- the condition under which to exit
+ * pc -- address of the instruction the interpreter must execute
+ */
+static void sideexit(int cc, size_t pc)
+{
+    if(nfixups >= sizeof(fixups)/sizeof(fixups[0])) die("too many side exits in block");
+    emit1(0x0F);
+    emit1(0x80 | cc);
+    fixups[nfixups].at = cp;
+    fixups[nfixups].pc = pc;
+    nfixups++;
+    emit4(0);
+}
+
+/*
+ * Translation
+ */
+
+/*
+ * checkaddr -- emit a side exit taken if the address in reg is not a
+ * valid memory address
+ */
+static void checkaddr(int reg, size_t pc)
+{
+    emitrex(0x48, 0x39, RBP, reg); /* CMP reg, rbp */
+    sideexit(CC_AE, pc);
+}
+
+/*
+ * markdirty -- emit code marking the page of the address in reg dirty
+ * (see mem.h). It always writes MARKDIRTYBYTES bytes.
+ */
+static void markdirty(int reg)
+{
+    int32_t disp;
+
+    /* rdi points at the registers in struct machine, so the dirty map
+     * is found at a fixed offset from it */
+    disp = (ptrdiff_t)offsetof(struct machine, dirty) - (ptrdiff_t)offsetof(struct machine, regs);
+    emitrex(0x48, 0x89, reg, RDX); /* MOV rdx, reg */
+    emit1(0x48); /* SHR rdx, PAGESHIFT */
+    emit1(0xC1);
+    emit1(0xC0 | (5 << 3) | RDX);
+    emit1(PAGESHIFT);
+    emit1(0x48); /* ADD rdx, [rdi+disp] */
+    emit1(0x03);
+    emit1(0x80 | (RDX << 3) | RDI);
+    emit4(disp);
+    emit1(0xC6); /* MOV byte [rdx], 1 */
+    emit1(0x00 | RDX);
+    emit1(1);
+}
+
+/*
+ * checkstore -- emit side exits taken if a store to the address in reg
+ * would fail or would hit the code area, followed by code marking the
+ * page of the address dirty
+ */
+static void checkstore(struct machine *m, int reg, size_t pc)
+{
+    checkaddr(reg, pc);
+    emitrr(0x89, reg, RDX); /* MOV rdx, reg */
+    if(m->codeoff) emitri(5, RDX, m->codeoff);
+    emitri(7, RDX, m->codesize);
+    sideexit(CC_B, pc);
+    markdirty(reg);
+}
+
+/*
+ * operand -- emit code computing the operand of an instruction into rax
+ *
+ * d -- the instruction
+ * pc -- its address
+ */
+static void operand(struct dinsn *d, size_t pc)
+{
+    if(d->idxreg)
+    {
+        emitrr(0x89, HOSTREG(d->idxreg), RAX);
+        if(d->imm) emitri(0, RAX, d->imm);
+    }
+    else emitmovimm(RAX, d->imm);
+    if((d->mode == 1) || (d->mode == 2))
+    {
+        checkaddr(RAX, pc);
+        emitmem(0x8B, RAX, RAX);
+    }
+    if(d->mode == 2)
+    {
+        checkaddr(RAX, pc);
+        emitmem(0x8B, RAX, RAX);
+    }
+}
+
+/*
+ * isimm -- tell whether an instruction's operand is a plain constant
+ */
+static int isimm(struct dinsn *d)
+{
+    return(((d->mode == 0) || (d->mode == 3)) && !d->idxreg);
+}
+
+/*
+ * translatable -- tell whether the translator handles an instruction
+ */
+static int translatable(struct dinsn *d)
+{
+    switch(d->opcode)
+    {
+    case 0x00: case 0x01: case 0x02:
+    case 0x11: case 0x12: case 0x13:
+    case 0x16: case 0x17: case 0x18:
+    case 0x1F:
+    case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26:
+    case 0x27: case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C:
+    case 0x33: case 0x34:
+        return(1);
+    case 0x19: case 0x1A: case 0x1B: /* shifts by a constant only */
+        return(isimm(d) && (d->imm < WORDBITS));
+    case 0x31: /* CALL, unless through the frame pointer */
+        return(d->reg != FP);
+    case 0x32: /* EXIT, popping a small constant number of parameters */
+        return((d->reg != FP) && isimm(d) && (d->imm <= 8));
+    }
+    return(0);
+}
+
+/*
+ * alu -- emit code for an arithmetic or logic instruction whose group
+ * 1 opcode extension or register-register opcode is given
+ */
+static void alu(struct dinsn *d, size_t pc, int ext, int op)
+{
+    if(isimm(d)) { emitri(ext, HOSTREG(d->reg), d->imm); return; }
+    operand(d, pc);
+    emitrr(op, RAX, HOSTREG(d->reg));
+}
+
+/*
+ * jcc -- emit code for a conditional jump. The flags have already been
+ * set; the jump is not taken under condition notcc.
+ */
+static void jcc(int notcc, size_t next)
+{
+    emitmovimm(RDX, next);
+    emitrr(0x0F40 | notcc, RAX, RDX); /* CMOVcc rax, rdx */
+}
+
+/*
+ * jit_flush -- throw away all translated code
+ *
+ * m -- the computer
+ */
+static void jit_flush(struct machine *m)
+{
+    cp = codebuf;
+    memset(blocks, 0, m->codesize * sizeof(block_t));
+    memset(heat, 0, m->codesize);
+}
+
+/*
+ * translate -- translate the block starting at the given address
+ *
+ * m -- the computer
+ * start -- address of the first instruction of the block
+ * return value -- the translated block, or a null pointer if the first
+ * instruction cannot be translated
+ */
+static block_t translate(struct machine *m, size_t start)
+{
+    struct dinsn insns[MAXBLOCKLEN];
+    unsigned char *entry, *epilogue;
+    block_t block;
+    struct dinsn *d;
+    size_t n, i, k, pc, end;
+    int used, dirty, done, g;
+    int32_t rel;
+
+    /* Find the extent of the block */
+    end = m->codeoff + m->codesize;
+    if(end > m->memsize) end = m->memsize;
+    used = dirty = 0;
+    for(n=0, pc=start; (n < MAXBLOCKLEN) && (pc < end); n++, pc++)
+    {
+        d = &insns[n];
+        predecode(d, m->mem[pc]);
+        if(!translatable(d)) break;
+        used |= (1 << d->reg) | (1 << d->idxreg);
+        dirty |= 1 << d->reg;
+        if(d->opcode == 0x34) dirty |= 1 << d->idxreg; /* POP */
+        if((d->opcode == 0x31) || (d->opcode == 0x32)) /* CALL, EXIT */
+        {
+            used |= (1 << SP) | (1 << FP);
+            dirty |= 1 << FP;
+        }
+        if((d->opcode >= 0x20) && (d->opcode <= 0x32)) { n++; break; }
+    }
+    if(!n) return(0);
+
+    if(cp + MAXBLOCKBYTES > codebuf + CODEBUFSIZE) jit_flush(m);
+    entry = cp;
+    nfixups = 0;
+
+    /* Prologue */
+    emitpush(RBX); emitpush(RBP);
+    emitpush(12); emitpush(13); emitpush(14); emitpush(15);
+    emitrex(0x48, 0x89, RDX, RBX); /* MOV rbx, rdx */
+    emitrex(0x48, 0x89, RCX, RBP); /* MOV rbp, rcx */
+    for(g=0; g<8; g++)
+        if(used & (1 << g))
+            emitdisp(0x8B, HOSTREG(g), RDI, g*sizeof(word_t));
+
+    /* Body. Each instruction leaves the next address in rax if it
+     * transfers control. */
+    done = 0;
+    for(i=0, pc=start; i<n; i++, pc++)
+    {
+        d = &insns[i];
+        g = HOSTREG(d->reg);
+        switch(d->opcode)
+        {
+        case 0x00: /*NOP*/
+            if((d->mode == 1) || (d->mode == 2)) operand(d, pc);
+            break;
+        case 0x01: /*STORE*/
+            operand(d, pc);
+            checkstore(m, RAX, pc);
+            emitmem(0x89, g, RAX);
+            break;
+        case 0x02: /*LOAD*/
+            if(isimm(d)) { emitmovimm(g, d->imm); break; }
+            operand(d, pc);
+            emitrr(0x89, RAX, g);
+            break;
+        case 0x11: alu(d, pc, 0, 0x01); break; /*ADD*/
+        case 0x12: alu(d, pc, 5, 0x29); break; /*SUB*/
+        case 0x13: /*MUL*/
+            operand(d, pc);
+            emitrr(0x0FAF, g, RAX); /* IMUL g, rax */
+            break;
+        case 0x16: alu(d, pc, 4, 0x21); break; /*AND*/
+        case 0x17: alu(d, pc, 1, 0x09); break; /*OR*/
+        case 0x18: alu(d, pc, 6, 0x31); break; /*XOR*/
+        case 0x19: emitshift(4, g, d->imm); break; /*SHL*/
+        case 0x1A: emitshift(5, g, d->imm); break; /*SHR*/
+        case 0x1B: emitshift(7, g, d->imm); break; /*SHRA*/
+        case 0x1F: /*COMP*/
+            operand(d, pc);
+            emitrr(0x39, RAX, g); /* CMP g, rax */
+            emitsetcc(CC_LESS, RCX);
+            emitsetcc(CC_E, RDX);
+            emitsetcc(CC_MORE, RAX);
+            emitshift(4, RCX, SR_L);
+            emitshift(4, RDX, SR_E);
+            emitshift(4, RAX, SR_G);
+            emitrr(0x09, RCX, RAX);
+            emitrr(0x09, RDX, RAX);
+            emitdisp(0x8B, RCX, RSI, 0);
+            emitri(4, RCX, ~((1<<SR_L) | (1<<SR_E) | (1<<SR_G)));
+            emitrr(0x09, RCX, RAX);
+            emitdisp(0x89, RAX, RSI, 0);
+            break;
+        case 0x20: /*JUMP*/
+            operand(d, pc);
+            done = 1;
+            break;
+        case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26:
+            /* JNEG JZER JPOS JNNEG JNZER JNPOS */
+            operand(d, pc);
+            emitrr(0x85, g, g); /* TEST g, g */
+            switch(d->opcode)
+            {
+            case 0x21: jcc(CC_NS, pc+1); break;
+            case 0x22: jcc(CC_NE, pc+1); break;
+            case 0x23: jcc(CC_LE, pc+1); break;
+            case 0x24: jcc(CC_S, pc+1); break;
+            case 0x25: jcc(CC_E, pc+1); break;
+            case 0x26: jcc(CC_G, pc+1); break;
+            }
+            done = 1;
+            break;
+        case 0x27: case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C:
+            /* JLES JEQU JGRE JNLES JNEQU JNGRE */
+            operand(d, pc);
+            emitdisp(0x8B, RCX, RSI, 0);
+            switch(d->opcode)
+            {
+            case 0x27: case 0x2A: emitri(4, RCX, 1<<SR_L); break;
+            case 0x28: case 0x2B: emitri(4, RCX, 1<<SR_E); break;
+            case 0x29: case 0x2C: emitri(4, RCX, 1<<SR_G); break;
+            }
+            jcc((d->opcode < 0x2A) ? CC_E : CC_NE, pc+1);
+            done = 1;
+            break;
+        case 0x31: /*CALL*/
+            operand(d, pc);
+            emitrr(0x89, g, RCX);
+            emitri(0, RCX, 1);
+            checkstore(m, RCX, pc);
+            emitri(0, RCX, 1);
+            checkstore(m, RCX, pc);
+            /* Both stores are known to succeed, so now do them */
+            emitmem(0x89, HOSTREG(FP), RCX);
+            emitrr(0x89, RCX, g);
+            emitri(5, RCX, 1);
+            emitmovimm(RDX, pc+1);
+            emitmem(0x89, RDX, RCX);
+            emitrr(0x89, HOSTREG(SP), HOSTREG(FP));
+            done = 1;
+            break;
+        case 0x32: /*EXIT*/
+            /* Check all the words to be popped before popping any */
+            emitrr(0x89, g, RCX);
+            for(k=0; k<d->imm+2; k++)
+            {
+                if(k) emitri(5, RCX, 1);
+                checkaddr(RCX, pc);
+            }
+            emitmem(0x8B, HOSTREG(FP), g);
+            emitri(5, g, 1);
+            emitmem(0x8B, RAX, g);
+            emitri(5, g, d->imm+1);
+            done = 1;
+            break;
+        case 0x33: /*PUSH*/
+            operand(d, pc);
+            emitrr(0x89, g, RCX);
+            emitri(0, RCX, 1);
+            checkstore(m, RCX, pc);
+            emitmem(0x89, RAX, RCX);
+            emitrr(0x89, RCX, g);
+            break;
+        case 0x34: /*POP*/
+            if((d->mode == 1) || (d->mode == 2)) operand(d, pc);
+            checkaddr(g, pc);
+            emitmem(0x8B, RCX, g);
+            emitri(5, g, 1);
+            emitrr(0x89, RCX, HOSTREG(d->idxreg));
+            break;
+        }
+    }
+    if(!done) emitmovimm(RAX, pc);
+    emitmovimm(RDX, n);
+
+    /* Epilogue */
+    epilogue = cp;
+    for(g=0; g<8; g++)
+        if(dirty & (1 << g))
+            emitdisp(0x89, HOSTREG(g), RDI, g*sizeof(word_t));
+    emitpop(15); emitpop(14); emitpop(13); emitpop(12);
+    emitpop(RBP); emitpop(RBX);
+    emit1(0xC3); /* RET */
+
+    /* Side exits */
+    for(i=0; i<nfixups; i++)
+    {
+        rel = cp - (fixups[i].at + 4);
+        memcpy(fixups[i].at, &rel, 4);
+        emitmovimm(RAX, fixups[i].pc);
+        emitmovimm(RDX, SIDE | (fixups[i].pc - start));
+        emit1(0xE9); /* JMP rel32 */
+        emit4(epilogue - (cp + 4));
+    }
+    if(cp - entry > MAXBLOCKBYTES) die("translated block larger than MAXBLOCKBYTES");
+
+    /* ISO C has no conversion from object to function pointers */
+    memcpy(&block, &entry, sizeof(block));
+    return(block);
+}
+
+/*
+ * step -- interpret the instruction at pc
+ *
+ * m -- the computer
+ *
+ * The instruction is decoded afresh, since stores done by translated
+ * code do not invalidate the instruction cache.
+ */
+static void step(struct machine *m)
+{
+    struct dinsn insn;
+
+    m->ir = getmem(m, m->pc);
+    predecode(&insn, m->ir);
+    m->pc++;
+    execute(m, &insn);
+    m->retired++;
+}
+
+/*
+ * simulate_jit -- execute the program until HALT, translating hot
+ * blocks to native code
+ *
+ * m -- the computer
+ *
+ * The caller has already established the stack.
+ */
+void simulate_jit(struct machine *m)
+{
+    struct jitexit x;
+    size_t seen, i;
+
+    if(!codebuf)
+    {
+        codebuf = mmap(0, CODEBUFSIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+                       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(codebuf == MAP_FAILED)
+        {
+            codebuf = 0;
+            die("cannot allocate memory for translated code");
+        }
+    }
+    /* A previous run in this thread may have died without freeing */
+    free(blocks);
+    free(heat);
+    if(!(blocks = calloc(m->codesize+1, sizeof(block_t)))) die("out of memory");
+    if(!(heat = calloc(m->codesize+1, 1))) die("out of memory");
+    jit_flush(m);
+
+    /* The side exit for stores into the code area compares against
+     * 32-bit constants; don't translate code that lies beyond them. */
+    if(size_add(m->codeoff, m->codesize) > INT32_MAX) memset(heat, NEVER, m->codesize);
+
+    seen = m->codestores;
+    while(!m->halted)
+    {
+        if(m->retired >= m->nextcheck) checklimits(m);
+        if(m->codestores != seen)
+        {
+            jit_flush(m);
+            seen = m->codestores;
+        }
+        i = m->pc - m->codeoff;
+        if(i < m->codesize)
+        {
+            if(blocks[i])
+            {
+                getsr(m);
+                x = blocks[i](m->regs, &m->sr, m->mem, m->memsize);
+                m->pc = x.pc;
+                m->retired += x.count & ~SIDE;
+                if(x.count & SIDE) step(m);
+                continue;
+            }
+            if(heat[i] < HOT) heat[i]++;
+            else if(heat[i] == HOT)
+            {
+                if((blocks[i] = translate(m, m->pc))) continue;
+                heat[i] = NEVER;
+            }
+        }
+        step(m);
+    }
+    free(blocks);
+    free(heat);
+    blocks = 0;
+    heat = 0;
+}
+
+/*
+ * jit_release -- release the code buffer and tables of this thread,
+ * which is about to end
+ */
+void jit_release(void)
+{
+    if(codebuf) munmap(codebuf, CODEBUFSIZE);
+    free(blocks);
+    free(heat);
+    codebuf = cp = 0;
+    blocks = 0;
+    heat = 0;
+}
+
+#else
+
+/*
+ * simulate_jit -- stub for hosts the translator doesn't know
+ */
+void simulate_jit(struct machine *m)
+{
+    die("JIT engine not supported on this host");
+}
+
+/*
+ * jit_release -- stub for hosts the translator doesn't know
+ */
+void jit_release(void)
+{
+}
+
+#endif
@@ -0,0 +1,7 @@
+/* Just-in-time compiler for x86-64 hosts. Runs the program just like
+ * simulate() does, translating hot basic blocks to native code. */
+
+struct machine;
+
+void simulate_jit(struct machine *m);
+void jit_release(void);
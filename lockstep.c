@@ -0,0 +1,607 @@
+/* Lockstep engine. Runs one program on several computers at once, one
+ * for each input, the way batch mode runs a program that the manifest
+ * lists against many inputs (see batch.c). The computers are called
+ * lanes here. While the program counters of the lanes agree, each
+ * instruction is fetched and decoded once and executed on all of them
+ * together: the registers are kept in vectors holding a word for each
+ * of several lanes, so that arithmetic, logic, shifts, comparisons and
+ * the tests of conditional jumps are done on several lanes with a
+ * single SIMD instruction. The vectors are a GCC extension, and are as
+ * wide as the SIMD registers the compiler is allowed to use: those of
+ * SSE2 on any x86-64, or those of AVX2 when building with -mavx2. GCC
+ * does the arithmetic on wider vectors too, but then falls back to
+ * one lane at a time for comparisons.
+ *
+ * Lanes whose program counters part ways, typically at a conditional
+ * jump, are split into groups of lanes that agree, and each group
+ * carries on in lockstep by itself; the groups never merge again. A
+ * group left with a single lane runs it to the end on the engine
+ * selected on the command line.
+ *
+ * Each lane has a memory of its own, so memory operands are loaded and
+ * stored one lane at a time. Anything that is not a plain computation
+ * on the registers and memory is left to the reference engine, which
+ * executes the instruction on each lane by itself (see stepcpu() in
+ * sim.c): I/O, supervisor calls, the stack instructions, instructions
+ * outside the code area, and any instruction that is about to fail on
+ * some lane, such as an invalid address or a division by zero. That
+ * way every lane behaves and fails exactly as it would run alone. A
+ * lane that stores into its code area, or spawns CPUs, leaves its
+ * group and runs alone, since the others no longer share its
+ * instruction stream.
+ *
+ * The instruction limit applies to each lane as usual. The time limit
+ * runs from the start of simulate_lockstep() for all the lanes at
+ * once, so it is the whole run that must finish in time. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "insn.h"
+#include "cpu.h"
+#include "sim.h"
+#include "lockstep.h"
+
+/* Size in bytes of a vector: that of the widest SIMD registers
+ * enabled */
+#ifdef __AVX2__
+#define VECBYTES 32
+#else
+#define VECBYTES 16
+#endif
+
+/* Lanes in a vector, and vectors in a word of every lane */
+#define VECLANES (VECBYTES/sizeof(word_t))
+#define NVEC (MAXLANES/VECLANES)
+
+/* A word for each of VECLANES lanes, taken as unsigned and as signed */
+typedef word_t vword __attribute__((vector_size(VECBYTES)));
+typedef sword_t vsword __attribute__((vector_size(VECBYTES)));
+
+/* A word for every lane. Lane i is element i % VECLANES of vector
+ * i / VECLANES. Being an array, it is always passed to functions by
+ * pointer, which keeps the calling convention of vectors, which
+ * depends on the SIMD instructions enabled, out of the picture. */
+typedef vword vlanes[NVEC];
+
+/* The word of lane i in v */
+#define LANE(v, i) ((v)[(i)/VECLANES][(i)%VECLANES])
+
+/* WORD_LT() of word.h on each lane: all bits set in the lanes where a
+ * is less than b, and none in the others */
+#if WORDBITS == 32
+#define VWORD_LT(a, b) ((vword)((vsword)(a) < (vsword)(b)))
+#else
+#define VWORD_LT(a, b) ((vword)((a) < (b)))
+#endif
+
+/* The bit of lane i in a lane mask */
+#define LANEBIT(i) (1u << (i))
+
+/* Lanes whose program counters agree. Since they have executed the
+ * same instructions since the start of the run, they also agree on
+ * the instruction count and on whether the state register is lazy. */
+struct group
+{
+    vlanes regs[8]; /* general purpose registers */
+    vlanes sr, cmpa, cmpb; /* the state register and the words last
+                            * compared, as in struct machine */
+    int srlazy; /* nonzero if sr lacks the result of the last COMP */
+    size_t pc;
+    size_t retired; /* count of instructions executed */
+    size_t nextcheck; /* value of retired at which to check the limits */
+    unsigned mask; /* LANEBIT(i) is set if lane i is in the group */
+};
+
+/* A run of simulate_lockstep() */
+struct lockstep
+{
+    struct lane *lanes;
+    struct group waiting[MAXLANES]; /* groups split off and not yet run */
+    size_t nwaiting;
+};
+
+/* Functions called through catchdie() */
+
+static void start(void *arg)
+{
+    startrun(arg);
+}
+
+static void step(void *arg)
+{
+    stepcpu(arg);
+}
+
+static void limits(void *arg)
+{
+    checklimits(arg);
+}
+
+/*
+ * Moving lanes in and out of groups
+ */
+
+/*
+ * putlane -- copy the state of a lane from its group into its computer
+ *
+ * g -- the group
+ * m -- the computer of the lane
+ * i -- the number of the lane
+ */
+static void putlane(struct group *g, struct machine *m, size_t i)
+{
+    size_t r;
+
+    for(r=0; r<8; r++) m->regs[r] = LANE(g->regs[r], i);
+    m->sr = LANE(g->sr, i);
+    m->cmpa = LANE(g->cmpa, i);
+    m->cmpb = LANE(g->cmpb, i);
+    m->srlazy = g->srlazy;
+    m->pc = g->pc;
+    m->retired = g->retired;
+}
+
+/*
+ * getlane -- copy the registers of a lane from its computer into its
+ * group
+ *
+ * g -- the group
+ * m -- the computer of the lane
+ * i -- the number of the lane
+ *
+ * The program counter and the instruction count are left to the
+ * caller.
+ */
+static void getlane(struct group *g, struct machine *m, size_t i)
+{
+    size_t r;
+
+    for(r=0; r<8; r++) LANE(g->regs[r], i) = m->regs[r];
+    LANE(g->sr, i) = m->sr;
+    LANE(g->cmpa, i) = m->cmpa;
+    LANE(g->cmpb, i) = m->cmpb;
+    g->srlazy = m->srlazy;
+}
+
+/*
+ * finish -- take a lane whose run has ended out of its group
+ *
+ * ls -- the run
+ * g -- the group
+ * i -- the number of the lane
+ * error -- the message of the error-exit that ended the run, as
+ * returned by catchdie(), or a null pointer if the program halted
+ */
+static void finish(struct lockstep *ls, struct group *g, size_t i, char *error)
+{
+    struct lane *l = &ls->lanes[i];
+
+    g->mask &= ~LANEBIT(i);
+    if(error)
+    {
+        snprintf(l->error, sizeof(l->error), "%s", error);
+        l->status = caughtstatus();
+    }
+    endcpus(l->m);
+}
+
+/*
+ * runalone -- take a lane out of its group and run it to the end by
+ * itself
+ *
+ * ls -- the run
+ * g -- the group
+ * i -- the number of the lane, whose computer already holds its state
+ */
+static void runalone(struct lockstep *ls, struct group *g, size_t i)
+{
+    finish(ls, g, i, catchdie(runcpuarg, ls->lanes[i].m));
+}
+
+/*
+ * regroup -- move the lanes of a group that are not going to execute
+ * the same instruction next into groups of their own
+ *
+ * ls -- the run
+ * g -- the group
+ * npc -- the program counter of each lane
+ *
+ * The group keeps the lanes that agree with its lowest numbered lane.
+ */
+static void regroup(struct lockstep *ls, struct group *g, size_t *npc)
+{
+    struct group *h;
+    unsigned rest;
+    size_t i, j;
+
+    if(!g->mask) return;
+    for(j=0; !(g->mask & LANEBIT(j)); j++) ;
+    g->pc = npc[j];
+    rest = 0;
+    for(i=j+1; i<MAXLANES; i++)
+        if((g->mask & LANEBIT(i)) && (npc[i] != g->pc)) rest |= LANEBIT(i);
+    g->mask &= ~rest;
+    while(rest)
+    {
+        for(j=0; !(rest & LANEBIT(j)); j++) ;
+        h = &ls->waiting[ls->nwaiting++];
+        *h = *g;
+        h->pc = npc[j];
+        h->mask = 0;
+        for(i=j; i<MAXLANES; i++)
+            if((rest & LANEBIT(i)) && (npc[i] == h->pc)) h->mask |= LANEBIT(i);
+        rest &= ~h->mask;
+    }
+}
+
+/*
+ * Executing instructions
+ */
+
+/*
+ * stepslow -- have the reference engine execute the instruction at
+ * the program counter of a group on some of its lanes, one lane at a
+ * time
+ *
+ * ls -- the run
+ * g -- the group
+ * slow -- mask of the lanes
+ *
+ * This must be done before the group's registers are updated for the
+ * other lanes. Lanes that halt or error-exit leave the group; for the
+ * rest, getslow() copies the result back into the group.
+ */
+static void stepslow(struct lockstep *ls, struct group *g, unsigned slow)
+{
+    struct machine *m;
+    char *error;
+    size_t i;
+
+    for(i=0; i<MAXLANES; i++)
+    {
+        if(!(slow & LANEBIT(i))) continue;
+        m = ls->lanes[i].m;
+        putlane(g, m, i);
+        if((error = catchdie(step, m))) finish(ls, g, i, error);
+        else if(m->halted) finish(ls, g, i, 0);
+    }
+}
+
+/*
+ * getslow -- copy the result of stepslow() back into a group
+ *
+ * ls -- the run
+ * g -- the group
+ * slow -- mask of the lanes passed to stepslow()
+ * npc -- where to store the program counter of each of the lanes
+ *
+ * Lanes that have stored into their code area or spawned CPUs leave the
+ * group and run alone.
+ */
+static void getslow(struct lockstep *ls, struct group *g, unsigned slow, size_t *npc)
+{
+    struct machine *m;
+    size_t i;
+
+    for(i=0; i<MAXLANES; i++)
+    {
+        if(!(slow & g->mask & LANEBIT(i))) continue;
+        m = ls->lanes[i].m;
+        if(m->codestores || m->smp) runalone(ls, g, i);
+        else
+        {
+            getlane(g, m, i);
+            npc[i] = m->pc;
+        }
+    }
+}
+
+/*
+ * checkgroup -- check whether the lanes of a group have exceeded their
+ * instruction or time limits, as checklimits() in sim.c does for one
+ * computer
+ *
+ * ls -- the run
+ * g -- the group
+ *
+ * Lanes that error-exit leave the group.
+ */
+static void checkgroup(struct lockstep *ls, struct group *g)
+{
+    struct machine *m;
+    char *error;
+    size_t i;
+
+    for(i=0; i<MAXLANES; i++)
+    {
+        if(!(g->mask & LANEBIT(i))) continue;
+        m = ls->lanes[i].m;
+        putlane(g, m, i);
+        if((error = catchdie(limits, m))) finish(ls, g, i, error);
+        else g->nextcheck = m->nextcheck;
+    }
+}
+
+/*
+ * operand -- work out the operand of an instruction on every lane of a
+ * group, as execute() in sim.c leaves it in the temporary register
+ *
+ * ls -- the run
+ * g -- the group
+ * insn -- the instruction
+ * tr -- where to store the operand of each lane
+ * return value -- mask of the lanes on which a memory operand has an
+ * invalid address
+ */
+static unsigned operand(struct lockstep *ls, struct group *g, struct dinsn *insn, vlanes tr)
+{
+    struct machine *m;
+    unsigned bad;
+    size_t i, k, a;
+
+    for(k=0; k<NVEC; k++) tr[k] = (vword){0} + insn->imm;
+    if(insn->idxreg)
+        for(k=0; k<NVEC; k++) tr[k] += g->regs[insn->idxreg][k];
+    if((insn->mode != 1) && (insn->mode != 2)) return(0);
+    bad = 0;
+    for(i=0; i<MAXLANES; i++)
+    {
+        if(!(g->mask & LANEBIT(i))) continue;
+        m = ls->lanes[i].m;
+        if((a = LANE(tr, i)) >= m->memsize)
+        {
+            bad |= LANEBIT(i);
+            continue;
+        }
+        LANE(tr, i) = m->mem[a];
+        if(insn->mode == 1) continue;
+        if((a = LANE(tr, i)) >= m->memsize) bad |= LANEBIT(i);
+        else LANE(tr, i) = m->mem[a];
+    }
+    return(bad);
+}
+
+/*
+ * srbit -- get the given bit of the state register of every lane of a
+ * group, as getsrbit() in sim.c does for one computer
+ *
+ * g -- the group
+ * bit -- index of the bit
+ * c -- where to store all bits set for the lanes where the bit is
+ * true, and none for the others
+ */
+static void srbit(struct group *g, size_t bit, vlanes c)
+{
+    size_t k;
+
+    for(k=0; k<NVEC; k++)
+        if(!g->srlazy) c[k] = -((g->sr[k] >> bit) & 1);
+        else if(bit == SR_L) c[k] = VWORD_LT(g->cmpa[k], g->cmpb[k]);
+        else if(bit == SR_E) c[k] = (vword)(g->cmpa[k] == g->cmpb[k]);
+        else c[k] = VWORD_LT(g->cmpb[k], g->cmpa[k]);
+}
+
+/*
+ * rungroup -- run the lanes of a group in lockstep until every one of
+ * them has halted, error-exited, left to run alone or been split off
+ * into another group
+ *
+ * ls -- the run
+ * g -- the group
+ */
+static void rungroup(struct lockstep *ls, struct group *g)
+{
+    struct machine *m, *lm;
+    struct dinsn *insn;
+    vlanes tr, c;
+    vword *r;
+    size_t npc[MAXLANES];
+    size_t i, k, pc, a;
+    unsigned slow, fast, taken;
+    int uniform;
+
+    for(;;)
+    {
+        if(!g->mask) return;
+        for(i=0; !(g->mask & LANEBIT(i)); i++) ;
+        if(!(g->mask & (g->mask-1)))
+        {
+            putlane(g, ls->lanes[i].m, i);
+            runalone(ls, g, i);
+            return;
+        }
+
+        /* The lanes only share the code area, which none of them has
+         * stored into. Instructions anywhere else are left to the
+         * reference engine. */
+        m = ls->lanes[i].m;
+        pc = g->pc;
+        slow = g->mask;
+        taken = 0;
+        uniform = 0;
+        insn = 0;
+        if(pc - m->codeoff < m->codesize)
+        {
+            insn = &m->icache[pc];
+            if(!insn->valid) predecode(insn, m->mem[pc]);
+            switch(insn->opcode)
+            {
+            case 0x00: case 0x01: case 0x02:
+            case 0x11: case 0x12: case 0x13: case 0x14: case 0x15:
+            case 0x16: case 0x17: case 0x18: case 0x19: case 0x1A: case 0x1B:
+            case 0x1F:
+            case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26:
+            case 0x27: case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C:
+                slow = operand(ls, g, insn, tr);
+                break;
+            }
+
+            /* Stores to invalid addresses or to the code area and
+             * divisions by zero go slow too */
+            if(insn->opcode == 0x01)
+                for(i=0; i<MAXLANES; i++)
+                {
+                    if(!(g->mask & ~slow & LANEBIT(i))) continue;
+                    lm = ls->lanes[i].m;
+                    a = LANE(tr, i);
+                    if((a >= lm->memsize) || (a - lm->codeoff < lm->codesize)) slow |= LANEBIT(i);
+                }
+            else if((insn->opcode == 0x14) || (insn->opcode == 0x15))
+                for(i=0; i<MAXLANES; i++)
+                    if((g->mask & LANEBIT(i)) && !LANE(tr, i)) slow |= LANEBIT(i);
+        }
+        if(slow) stepslow(ls, g, slow);
+        fast = g->mask & ~slow;
+
+        /* Execute the instruction on the other lanes. An operand that
+         * is an immediate value is the same on every lane, which lets
+         * shifts shift every lane by the same count, as SSE2 can. */
+        if(fast)
+        {
+            r = g->regs[insn->reg];
+            uniform = !insn->idxreg && (insn->mode != 1) && (insn->mode != 2);
+            switch(insn->opcode)
+            {
+            case 0x00: /*NOP*/
+                break;
+            case 0x01: /*STORE*/
+                for(i=0; i<MAXLANES; i++)
+                    if(fast & LANEBIT(i)) setmem(ls->lanes[i].m, LANE(tr, i), LANE(r, i));
+                break;
+            case 0x02: for(k=0; k<NVEC; k++) r[k] = tr[k]; break; /*LOAD*/
+            case 0x11: for(k=0; k<NVEC; k++) r[k] += tr[k]; break; /*ADD*/
+            case 0x12: for(k=0; k<NVEC; k++) r[k] -= tr[k]; break; /*SUB*/
+            case 0x13: for(k=0; k<NVEC; k++) r[k] *= tr[k]; break; /*MUL*/
+            case 0x14: /*DIV*/
+                for(i=0; i<MAXLANES; i++)
+                    if(fast & LANEBIT(i)) LANE(r, i) = word_div(LANE(r, i), LANE(tr, i));
+                break;
+            case 0x15: /*MOD*/
+                for(i=0; i<MAXLANES; i++)
+                    if(fast & LANEBIT(i)) LANE(r, i) = word_mod(LANE(r, i), LANE(tr, i));
+                break;
+            case 0x16: for(k=0; k<NVEC; k++) r[k] &= tr[k]; break; /*AND*/
+            case 0x17: for(k=0; k<NVEC; k++) r[k] |= tr[k]; break; /*OR*/
+            case 0x18: for(k=0; k<NVEC; k++) r[k] ^= tr[k]; break; /*XOR*/
+            case 0x19: /*SHL*/
+                if(uniform) for(k=0; k<NVEC; k++) r[k] <<= insn->imm & (WORDBITS-1);
+                else for(k=0; k<NVEC; k++) r[k] <<= tr[k] & (WORDBITS-1);
+                break;
+            case 0x1A: /*SHR*/
+                if(uniform) for(k=0; k<NVEC; k++) r[k] >>= insn->imm & (WORDBITS-1);
+                else for(k=0; k<NVEC; k++) r[k] >>= tr[k] & (WORDBITS-1);
+                break;
+            case 0x1B: /*SHRA*/
+                /* GCC shifts negative signed vector elements arithmetically */
+                if(uniform) for(k=0; k<NVEC; k++) r[k] = (vword)((vsword)r[k] >> (insn->imm & (WORDBITS-1)));
+                else for(k=0; k<NVEC; k++) r[k] = (vword)((vsword)r[k] >> (vsword)(tr[k] & (WORDBITS-1)));
+                break;
+            case 0x1F: /*COMP*/
+                for(k=0; k<NVEC; k++)
+                {
+                    g->cmpa[k] = r[k];
+                    g->cmpb[k] = tr[k];
+                }
+                g->srlazy = 1;
+                break;
+            case 0x20: for(k=0; k<NVEC; k++) c[k] = ~(vword){0}; break; /*JUMP*/
+            case 0x21: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] < 0); break; /*JNEG*/
+            case 0x22: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] == 0); break; /*JZER*/
+            case 0x23: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] > 0); break; /*JPOS*/
+            case 0x24: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] >= 0); break; /*JNNEG*/
+            case 0x25: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] != 0); break; /*JNZER*/
+            case 0x26: for(k=0; k<NVEC; k++) c[k] = (vword)((vsword)r[k] <= 0); break; /*JNPOS*/
+            case 0x27: srbit(g, SR_L, c); break; /*JLES*/
+            case 0x28: srbit(g, SR_E, c); break; /*JEQU*/
+            case 0x29: srbit(g, SR_G, c); break; /*JGRE*/
+            case 0x2A: /*JNLES*/
+                srbit(g, SR_L, c);
+                for(k=0; k<NVEC; k++) c[k] = ~c[k];
+                break;
+            case 0x2B: /*JNEQU*/
+                srbit(g, SR_E, c);
+                for(k=0; k<NVEC; k++) c[k] = ~c[k];
+                break;
+            case 0x2C: /*JNGRE*/
+                srbit(g, SR_G, c);
+                for(k=0; k<NVEC; k++) c[k] = ~c[k];
+                break;
+            }
+            if((insn->opcode >= 0x20) && (insn->opcode <= 0x2C))
+            {
+                for(i=0; i<MAXLANES; i++) taken |= (unsigned)(LANE(c, i) & 1) << i;
+                taken &= fast;
+            }
+        }
+        g->retired++;
+
+        /* Work out where each lane goes next, splitting the group if
+         * they disagree */
+        if(!slow && !taken) g->pc = pc+1;
+        else if(!slow && (taken == g->mask) && uniform) g->pc = (word_t)insn->imm;
+        else
+        {
+            for(i=0; i<MAXLANES; i++)
+                npc[i] = (taken & LANEBIT(i)) ? (size_t)LANE(tr, i) : pc+1;
+            getslow(ls, g, slow, npc);
+            regroup(ls, g, npc);
+        }
+        if((g->pc != pc+1) && (g->retired >= g->nextcheck)) checkgroup(ls, g);
+    }
+}
+
+/*
+ * simulate_lockstep -- run the same program on several computers at
+ * once until each one halts or error-exits
+ *
+ * lanes -- the computers, each with its own copy of the program
+ * loaded, not yet run, and its own I/O streams, and where to store how
+ * each run ended
+ * n -- the number of computers, at most MAXLANES
+ *
+ * An error-exit only ends the run of the computer that did it.
+ */
+void simulate_lockstep(struct lane *lanes, size_t n)
+{
+    struct lockstep ls;
+    struct group g;
+    struct machine *m;
+    size_t npc[MAXLANES];
+    char *error;
+    size_t i;
+
+    if(n > MAXLANES) die("too many lanes");
+    ls.lanes = lanes;
+    ls.nwaiting = 0;
+    memset(&g, 0, sizeof(g));
+    for(i=0; i<n; i++)
+    {
+        m = lanes[i].m;
+        lanes[i].status = 0;
+        lanes[i].error[0] = 0;
+        g.mask |= LANEBIT(i);
+        if((error = catchdie(start, m)))
+        {
+            finish(&ls, &g, i, error);
+            continue;
+        }
+        getlane(&g, m, i);
+        npc[i] = m->pc;
+        g.retired = m->retired;
+        g.nextcheck = m->nextcheck;
+    }
+    regroup(&ls, &g, npc);
+    for(;;)
+    {
+        rungroup(&ls, &g);
+        if(!ls.nwaiting) break;
+        g = ls.waiting[--ls.nwaiting];
+    }
+}
@@ -0,0 +1,19 @@
+/* Lockstep engine. Runs one program on several computers at once, one
+ * for each input, executing the instructions their program counters
+ * agree on for all of them together. See lockstep.c. */
+
+/* Most computers simulate_lockstep() can run at once */
+#define MAXLANES 16
+
+struct machine;
+
+/* A computer run by simulate_lockstep(), and how its run ended */
+struct lane
+{
+    struct machine *m; /* the computer, with the program loaded */
+    int status; /* 0 if the program halted, otherwise the exit status
+                 * of the error-exit that ended the run */
+    char error[256]; /* the message of that error-exit */
+};
+
+void simulate_lockstep(struct lane *lanes, size_t n);
@@ -0,0 +1,122 @@
+/* The state of one simulated TTK-91 computer: its memory, registers,
+ * symbol table and I/O streams. The modules that operate on the
+ * computer all take a pointer to one of these, so that any number of
+ * computers can be simulated at once, each in its own thread (see
+ * batch.c). */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "icache.h"
+#include "sym.h"
+#include "io.h"
+#include "dev.h"
+
+/*
+ * initmachine -- set up a computer with no memory, zeroed registers
+ * and I/O through standard input and output
+ *
+ * m -- the computer
+ */
+void initmachine(struct machine *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->in = stdin;
+    m->out = stdout;
+}
+
+/*
+ * copymachine -- give a computer a fresh copy of the program loaded
+ * into another
+ *
+ * m -- the computer, with no memory
+ * t -- the computer holding the program, not yet run
+ *
+ * The symbol table is not copied.
+ */
+void copymachine(struct machine *m, struct machine *t)
+{
+    addmem(m, t->memsize);
+    memcpy(m->mem, t->mem, t->memsize*sizeof(word_t));
+    m->codeoff = t->codeoff;
+    m->codesize = t->codesize;
+    m->dataoff = t->dataoff;
+    m->datasize = t->datasize;
+}
+
+/*
+ * freemachine -- release everything allocated for a computer
+ *
+ * m -- the computer. It may be set up again with initmachine(). Its
+ * I/O streams are left open.
+ */
+void freemachine(struct machine *m)
+{
+    free(m->kept);
+    m->kept = 0;
+    freemem(m);
+    icache_free(m);
+    freesyms(m);
+    freedevices(m);
+    freeio(m);
+}
+
+/*
+ * keepstate -- remember the state of a computer, so that reset() can
+ * bring it back
+ *
+ * m -- the computer, normally with a program loaded and its stack
+ * established (see startstack() in sim.c), but not yet run
+ *
+ * Keeps a copy of the memory and of the registers. The memory must not
+ * grow afterwards.
+ */
+void keepstate(struct machine *m)
+{
+    keepmem(m);
+    if(!m->kept && !(m->kept = malloc(sizeof(*m->kept)))) die("out of memory");
+    *m->kept = *m;
+}
+
+/*
+ * reset -- bring a computer back to the state keepstate() kept, to run
+ * its program again
+ *
+ * m -- the computer
+ *
+ * Restores the memory pages written since (see resetmem() in mem.c),
+ * the general purpose and control registers and the instruction
+ * count, and empties the I/O buffers. Anything still in the output
+ * buffer is thrown away, so the output of the previous run must have
+ * been flushed. Symbols, devices and I/O streams are left alone.
+ */
+void reset(struct machine *m)
+{
+    struct machine *k = m->kept;
+
+    if(!k) die("computer state not kept");
+    resetmem(m);
+    memcpy(m->regs, k->regs, sizeof(m->regs));
+    m->pc = k->pc;
+    m->ir = k->ir;
+    m->tr = k->tr;
+    m->sr = k->sr;
+    m->cmpa = k->cmpa;
+    m->cmpb = k->cmpb;
+    m->srlazy = k->srlazy;
+    m->halted = k->halted;
+    m->started = k->started;
+    m->retired = k->retired;
+    m->fused = k->fused;
+    m->codestores = k->codestores;
+    m->outlen = 0;
+    m->ninput = m->inputpos = 0;
+    m->inputread = 0;
+}
@@ -0,0 +1,111 @@
+/* The state of one simulated TTK-91 computer: its memory, registers,
+ * symbol table and I/O streams. The modules that operate on the
+ * computer all take a pointer to one of these, so that any number of
+ * computers can be simulated at once, each in its own thread (see
+ * batch.c). <stdio.h> and "word.h" must be included before this
+ * header. */
+
+struct dinsn;
+struct syment;
+struct trace;
+struct profile;
+struct device;
+struct iolog;
+struct smp;
+
+struct machine
+{
+    /* Memory, see mem.c */
+    word_t *mem; /* array of words containing the entire memory */
+    size_t memsize; /* current size in words of the entire memory */
+    size_t codeoff; /* offset in memory of first code word */
+    size_t codesize; /* size in words of code area */
+    size_t dataoff; /* offset in memory of first data word */
+    size_t datasize; /* size in words of data area */
+    size_t codestores; /* count of stores into the code area */
+    char *region; /* host address space reserved for the memory */
+    size_t regionsize; /* size in bytes of the region */
+    size_t committed; /* bytes at the start of the region that are accessible */
+    unsigned char *dirty; /* a byte per page, nonzero if written since keepmem() */
+    size_t dirtysize; /* bytes in dirty */
+    word_t *pristine; /* copy of the memory made by keepmem(), or a null pointer */
+    size_t pristinesize; /* words in pristine */
+
+    /* Pre-decoded instruction cache, see icache.c */
+    struct dinsn *icache; /* one entry per memory word, plus one */
+    size_t icachesize; /* entries in the cache */
+
+    /* General purpose registers, see reg.c */
+    word_t regs[8];
+
+    /* Control registers, see sim.c */
+    size_t pc; /* Program counter */
+    word_t ir; /* Instruction register */
+    word_t tr; /* Temporary register */
+    word_t sr; /* State register, see getsr() */
+    word_t cmpa, cmpb; /* words compared by the last COMP, while srlazy */
+    int srlazy; /* Nonzero if sr lacks the result of the last COMP */
+    int halted; /* Nonzero if the HALT supervisor call has been issued */
+    int started; /* Nonzero once simulate() has established the stack */
+
+    /* Copy of the state made by keepstate(), see machine.c, or a null
+     * pointer */
+    struct machine *kept;
+
+    /* Resource limits, see checklimits() in sim.c */
+    size_t retired; /* count of instructions executed */
+    size_t nextcheck; /* value of retired at which to check the limits */
+    double deadline; /* monotonic clock time at which the run times out, or 0 */
+
+    /* Superinstructions, see threaded.c */
+    size_t fused; /* count of instructions executed by fused handlers */
+
+    /* Symbol table, see sym.c */
+    struct syment *syms; /* entries in the order they were added */
+    size_t nsym; /* count of entries */
+    size_t symcap; /* room for entries in syms */
+    size_t *symhash; /* hash index by name */
+    size_t symhashsize; /* slots in symhash */
+    struct syment **symbyaddr; /* index by address, or a null pointer */
+
+    /* Execution trace, see trace.c */
+    struct trace *trace; /* a null pointer unless tracing */
+    size_t lastreg; /* number of the last register stored by setreg() */
+    size_t lastwrite; /* address of the last word stored by setmem() */
+
+    /* Execution profile, see profile.c */
+    struct profile *profile; /* a null pointer unless profiling */
+
+    /* Recorded or replayed I/O, see iolog.c */
+    struct iolog *iolog; /* a null pointer unless recording or replaying */
+
+    /* CPUs started by the program, see cpu.c. Each CPU is a struct
+     * machine of its own sharing the memory of the first. */
+    struct smp *smp; /* a null pointer until the program starts a CPU */
+    size_t cpu; /* number of this CPU, 0 for the first one */
+    int yield; /* nonzero when the CPU is to give up its turn */
+
+    /* Devices bound to the ports, see dev.c */
+    struct device *devices; /* NPORTS entries, or a null pointer until used */
+
+    /* Streams that the console devices read from and write to */
+    FILE *in;
+    FILE *out;
+
+    /* Buffers of the console devices in buffered mode, see io.c */
+    int buffered; /* nonzero in buffered mode */
+    char *outbuf; /* output not yet written to out */
+    size_t outlen; /* bytes in outbuf */
+    size_t outcap; /* room for bytes in outbuf */
+    word_t *input; /* words parsed from in */
+    size_t ninput; /* count of words in input */
+    size_t inputcap; /* room for words in input */
+    size_t inputpos; /* index in input of the next word to read */
+    int inputread; /* nonzero once in has been parsed into input */
+};
+
+void initmachine(struct machine *m);
+void copymachine(struct machine *m, struct machine *t);
+void freemachine(struct machine *m);
+void keepstate(struct machine *m);
+void reset(struct machine *m);
@@ -1,62 +1,337 @@
-/* Represents the simulated computer's memory. */
+/* Represents the simulated computer's memory. The memory lives in a
+ * region of host address space reserved up front, which is followed
+ * by inaccessible pages, so that accesses need no bounds checks: an
+ * access to an invalid address faults, and the simulator catches the
+ * fault. The memory itself is part of struct machine.
+ *
+ * To run a program many times in one process without loading it again,
+ * keepmem() keeps a pristine copy of the memory, and resetmem() copies
+ * back the pages that have been written since, as recorded in a map
+ * with a byte per page that every store sets. */
+
+#define _DEFAULT_SOURCE
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "size.h"
 #include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "insn.h"
+#include "icache.h"
+#include "ckone.h"
 #include "mem.h"
 
-size_t *mem;
-size_t memsize;
-size_t codeoff;
-size_t codesize;
-size_t dataoff;
-size_t datasize;
+/*
+ * reserve -- reserve the region of host address space for the memory
+ *
+ * m -- the computer
+ *
+ * Only the start of the region is ever made accessible, so that any
+ * access beyond the end of the memory faults. The region holds
+ * MEMRESERVE words, plus a page of slack since the memory is placed
+ * to end on a page boundary, plus a guard page for the clamped
+ * addresses of MEMCLAMP().
+ */
+static void reserve(struct machine *m)
+{
+    size_t page;
+    void *region;
+
+    page = sysconf(_SC_PAGESIZE);
+    m->regionsize = size_add(MEMRESERVE*sizeof(word_t), 2*page);
+    region = mmap(0, m->regionsize, PROT_NONE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if(region == MAP_FAILED) die("cannot reserve address space for memory");
+    m->region = region;
+}
+
+/*
+ * resizedirty -- make the dirty map cover all of the memory
+ *
+ * m -- the computer, whose memory has just grown
+ *
+ * The map is a multiple of eight bytes long, so that resetmem() can
+ * scan it eight pages at a time. Pages added are marked clean.
+ */
+static void resizedirty(struct machine *m)
+{
+    size_t npages;
+
+    npages = ((m->memsize >> PAGESHIFT) + 8) & ~(size_t)7;
+    if(npages <= m->dirtysize) return;
+    if(!(m->dirty = realloc(m->dirty, npages))) die("out of memory");
+    memset(m->dirty + m->dirtysize, 0, npages - m->dirtysize);
+    m->dirtysize = npages;
+}
 
 /* 
  * addmem -- Add memory at the end of the address space of the
  * simulated computer.
  *
+ * m -- the computer
  * increment -- how many words to add
  *
- * error-exists if there isn't enough memory available for the host process
+ * error-exists if there isn't enough memory available for the host
+ * process, or with LIMITSTATUS if the memory would grow past the
+ * limit set with --max-mem
+ *
+ * The memory is placed so that it ends exactly where the inaccessible
+ * part of the region begins, so growing it moves its contents and
+ * m->mem changes; see mem.h for when it may be called. The words added
+ * are zeroed.
+ */
+void addmem(struct machine *m, size_t increment)
+{
+    size_t newsize, need, page;
+    word_t *newmem;
+
+    if(!m->region) reserve(m);
+    newsize = size_add(m->memsize, increment);
+    if(newsize > MEMRESERVE) die("out of memory");
+    if(newsize > maxmem) dielimit("memory limit exceeded");
+    page = sysconf(_SC_PAGESIZE);
+    need = (newsize*sizeof(word_t) + page-1) / page * page;
+    if(need > m->committed)
+    {
+        if(mprotect(m->region, need, PROT_READ|PROT_WRITE)) die("out of memory");
+        m->committed = need;
+    }
+    newmem = (word_t *)(m->region + m->committed) - newsize;
+    if(m->memsize) memmove(newmem, m->mem, m->memsize*sizeof(word_t));
+    memset(newmem+m->memsize, 0, increment*sizeof(word_t));
+    m->mem = newmem;
+    m->memsize = newsize;
+    icache_resize(m, m->memsize);
+    resizedirty(m);
+}
+
+/*
+ * mapmem -- give a computer memory mapped copy-on-write from a file
+ *
+ * m -- the computer, which has no memory yet
+ * fd -- the file
+ * off -- offset in the file of an image of the accessible start of the
+ * region, with the memory at its end
+ * size -- size in bytes of the image
+ * memsize -- size in words of the memory
+ *
+ * Any number of computers, in any number of processes, can map the
+ * same file; they share its pages until they write to them. If the
+ * image doesn't line up with the host's pages, the memory is read
+ * from the file instead.
  */
-void addmem(size_t increment)
+void mapmem(struct machine *m, int fd, size_t off, size_t size, size_t memsize)
 {
-    memsize = size_add(memsize, increment);
-    if(!(mem = realloc(mem, size_mul(memsize, sizeof(size_t))))) die("out of memory");
+    size_t page, bytes;
+    void *p;
+
+    if(m->memsize) die("memory already in use");
+    bytes = size_mul(memsize, sizeof(word_t));
+    if((memsize > MEMRESERVE) || (bytes > size)) die("bad memory size");
+    if(memsize > maxmem) dielimit("memory limit exceeded");
+    page = sysconf(_SC_PAGESIZE);
+    if(!m->region) reserve(m);
+    if((off % page) || (size % page) || (size > m->regionsize - 2*page))
+    {
+        addmem(m, memsize);
+        if((size_t)pread(fd, m->mem, bytes, off+size-bytes) != bytes) die("cannot read memory from file");
+        return;
+    }
+    p = mmap(m->region, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, off);
+    if(p == MAP_FAILED) die("cannot map memory from file");
+    m->committed = size;
+    m->mem = (word_t *)(m->region + size) - memsize;
+    m->memsize = memsize;
+    icache_resize(m, m->memsize);
+    resizedirty(m);
 }
 
 /*
- * checkaddr -- error-exit if the given address is out of bounds
+ * freemem -- give the memory of a computer back to the host
  *
- * addr -- the given address
+ * m -- the computer, whose memory size becomes zero
  */
-void checkaddr(size_t addr)
+void freemem(struct machine *m)
 {
-    if(addr < memsize) return;
-    die("invalid memory address");
+    if(m->region) munmap(m->region, m->regionsize);
+    m->region = 0;
+    m->regionsize = m->committed = 0;
+    m->mem = 0;
+    m->memsize = 0;
+    free(m->dirty);
+    free(m->pristine);
+    m->dirty = 0;
+    m->pristine = 0;
+    m->dirtysize = m->pristinesize = 0;
+}
+
+/*
+ * keepmem -- keep a pristine copy of the memory of a computer for
+ * resetmem() to restore
+ *
+ * m -- the computer
+ *
+ * Marks every page clean. The memory must not grow afterwards.
+ */
+void keepmem(struct machine *m)
+{
+    if(!(m->pristine = realloc(m->pristine, size_mul(m->memsize ? m->memsize : 1, sizeof(word_t)))))
+        die("out of memory");
+    memcpy(m->pristine, m->mem, m->memsize*sizeof(word_t));
+    m->pristinesize = m->memsize;
+    memset(m->dirty, 0, m->dirtysize);
+}
+
+/*
+ * restorepage -- copy a page back from the pristine copy of the memory
+ * and mark it clean
+ *
+ * m -- the computer
+ * page -- the page number
+ *
+ * Also invalidates the pre-decoded instructions cached for the page.
+ */
+static void restorepage(struct machine *m, size_t page)
+{
+    size_t addr, end;
+
+    addr = page << PAGESHIFT;
+    end = addr + ((size_t)1 << PAGESHIFT);
+    if(end > m->memsize) end = m->memsize;
+    memcpy(m->mem + addr, m->pristine + addr, (end-addr)*sizeof(word_t));
+    for(; addr<end; addr++) ICACHE_INVALIDATE(m->icache, addr);
+    m->dirty[page] = 0;
+}
+
+/*
+ * resetmem -- give a computer back the memory keepmem() kept
+ *
+ * m -- the computer
+ *
+ * Only the pages written since are copied, so the cost is that of the
+ * pages a run has written, plus a scan of the dirty map eight pages at
+ * a time.
+ */
+void resetmem(struct machine *m)
+{
+    uint64_t eight;
+    size_t i, k;
+
+    if(!m->pristine || (m->memsize != m->pristinesize)) die("memory changed size since it was kept");
+    for(i=0; i<m->dirtysize; i+=8)
+    {
+        memcpy(&eight, m->dirty+i, 8);
+        if(!eight) continue;
+        for(k=i; k<i+8; k++)
+            if(m->dirty[k]) restorepage(m, k);
+    }
+}
+
+/*
+ * memfault -- tell whether a host address lies in the region reserved
+ * for the memory
+ *
+ * m -- the computer
+ * addr -- the faulting address, from a SIGSEGV handler
+ * return value -- nonzero if an access to the simulated computer's
+ * memory caused the fault
+ */
+int memfault(struct machine *m, void *addr)
+{
+    return(m->region && ((char *)addr >= m->region) && ((char *)addr < m->region+m->regionsize));
 }
 
 /*
  * getmem -- fetch a word from memory
  *
+ * m -- the computer
  * addr -- the address of the word
+ *
+ * There is no bounds check: an invalid address hits the inaccessible
+ * part of the region and raises SIGSEGV, which the simulator turns
+ * into an error-exit.
  */
-size_t getmem(size_t addr)
+word_t getmem(struct machine *m, size_t addr)
 {
-    checkaddr(addr);
-    return(mem[addr]);
+    return(m->mem[MEMCLAMP(addr)]);
+}
+
+/*
+ * stored -- do the bookkeeping for a word just stored in memory
+ *
+ * m -- the computer
+ * addr -- the address of the word
+ */
+static void stored(struct machine *m, size_t addr)
+{
+    MEMDIRTY(m, addr);
+    ICACHE_INVALIDATE(m->icache, addr);
+    m->lastwrite = addr;
+    if((addr >= m->codeoff) && (addr-m->codeoff < m->codesize)) m->codestores++;
 }
 
 /*
  * setmem -- store a word in memory
  *
+ * m -- the computer
  * addr -- the address in which the word is to be stored
  * word -- the word to be stored
+ *
+ * Also marks the page dirty, invalidates the pre-decoded instructions
+ * cached for the address, and counts stores into the code area, so
+ * that self-modifying programs work, and remembers the address for the
+ * execution trace. Invalid addresses fault as in getmem().
+ */
+void setmem(struct machine *m, size_t addr, word_t word)
+{
+    m->mem[MEMCLAMP(addr)] = word;
+    stored(m, addr);
+}
+
+/*
+ * casmem -- compare a word in memory with a given word and replace it
+ * if they are equal, atomically with respect to the other CPUs (see
+ * cpu.c)
+ *
+ * m -- the computer
+ * addr -- the address of the word
+ * expect -- the word it is expected to hold
+ * word -- the word to replace it with
+ * return value -- the word it held
+ *
+ * Invalid addresses fault as in getmem().
  */
-void setmem(size_t addr, size_t word)
+word_t casmem(struct machine *m, size_t addr, word_t expect, word_t word)
 {
-    checkaddr(addr);
-    mem[addr] = word;
+    word_t old = expect;
+
+    if(__atomic_compare_exchange_n(&m->mem[MEMCLAMP(addr)], &old, word, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        stored(m, addr);
+    return(old);
+}
+
+/*
+ * faamem -- add to a word in memory, atomically with respect to the
+ * other CPUs (see cpu.c)
+ *
+ * m -- the computer
+ * addr -- the address of the word
+ * incr -- the word to add
+ * return value -- the word it held before
+ *
+ * Invalid addresses fault as in getmem().
+ */
+word_t faamem(struct machine *m, size_t addr, word_t incr)
+{
+    word_t old;
+
+    old = __atomic_fetch_add(&m->mem[MEMCLAMP(addr)], incr, __ATOMIC_SEQ_CST);
+    stored(m, addr);
+    return(old);
 }
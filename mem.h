@@ -1,23 +1,40 @@
-/* Represents the simulated computer's memory. */
+/* Represents the simulated computer's memory. The memory lives in a
+ * region of host address space reserved up front, which is followed
+ * by inaccessible pages, so that accesses need no bounds checks: an
+ * access to an invalid address faults, and the simulator catches the
+ * fault. The memory itself is part of struct machine. */
 
-/* An array of words containing the entire memory, expandable at will. */ 
-extern size_t *mem;
+/* Maximum size in words of the memory */
+#define MEMRESERVE ((size_t)1 << 28)
 
-/* Current size in words of the entire memory. */
-extern size_t memsize;
+/* Map an address to an index into mem[]: valid addresses map to
+ * themselves and invalid ones to somewhere that faults. Compilers turn
+ * this into a conditional move rather than a branch. */
+#define MEMCLAMP(addr) ((addr) < MEMRESERVE ? (addr) : MEMRESERVE)
 
-/* Offset in memory of first code word */
-extern size_t codeoff;
+/* The memory is divided into pages of 1 << PAGESHIFT words, and every
+ * store marks the page it writes in the dirty map, so that resetmem()
+ * only has to restore the pages a run has written */
+#define PAGESHIFT 9
 
-/* Size in words of code area */
-extern size_t codesize;
+/* Mark the page holding the word at addr as written */
+#define MEMDIRTY(m, addr) ((m)->dirty[(addr) >> PAGESHIFT] = 1)
 
-/* Offset in memory of first data word */
-extern size_t dataoff;
+struct machine;
 
-/* Size in words of data area */
-extern size_t datasize;
-
-void addmem(size_t increment);
-void setmem(size_t addr, size_t word);
-size_t getmem(size_t addr);
+/* addmem() keeps the memory flush with the inaccessible pages after
+ * it, so it moves the memory and changes m->mem every time it grows.
+ * Memory is only added while a program is loaded and its stack set up
+ * by startstack(); the engines, the CPUs a program spawns and
+ * everything else holding on to m->mem rely on it not growing after
+ * that. */
+void addmem(struct machine *m, size_t increment);
+void mapmem(struct machine *m, int fd, size_t off, size_t size, size_t memsize);
+void freemem(struct machine *m);
+void keepmem(struct machine *m);
+void resetmem(struct machine *m);
+int memfault(struct machine *m, void *addr);
+void setmem(struct machine *m, size_t addr, word_t word);
+word_t getmem(struct machine *m, size_t addr);
+word_t casmem(struct machine *m, size_t addr, word_t expect, word_t word);
+word_t faamem(struct machine *m, size_t addr, word_t incr);
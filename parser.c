@@ -1,5 +1,7 @@
 /* Parser for the .b91 file format that describes pre-assembled TTK-91
- * programs. */
+ * programs. The input is read in large blocks and scanned with a
+ * character class table, so the cost per character is a table lookup
+ * rather than a call to the C library. */
 
 #include <ctype.h>
 #include <limits.h>
@@ -11,6 +13,8 @@
 
 #include "size.h"
 #include "die.h"
+#include "word.h"
+#include "machine.h"
 #include "sym.h"
 #include "mem.h"
 #include "parser.h"
@@ -22,32 +26,113 @@
 /* Maximum length of a token in characters, not counting the null terminator. */
 #define MAXTOKLEN 255
 
-/* Input stream, doesn't matter whether it is in text or binary mode. */
-static FILE *input;
+/* Size in bytes of the blocks in which the input file is read */
+#define BLOCKSIZE 65536
 
-/* Buffer for the next input token. Null-terminated. */
-static char buf[MAXTOKLEN+1];
+/* The state of one parse. Each function below takes a pointer to
+ * one of these as its first argument, so that several files can be
+ * parsed at once in different threads. */
+struct parser
+{
+    /* Input stream, doesn't matter whether it is in text or binary mode. */
+    FILE *input;
+
+    /* The block of input being scanned, the index of its next unread
+     * character and the count of characters in it. */
+    unsigned char block[BLOCKSIZE];
+    size_t pos;
+    size_t len;
+
+    /* Character class table: the classes (see below) each character
+     * belongs to, as a bitmask */
+    unsigned char class[UCHAR_MAX+1];
+
+    /* Buffer for the next input token. Null-terminated. */
+    char buf[MAXTOKLEN+1];
+
+    /* The computer into whose memory the file is loaded */
+    struct machine *m;
+};
+
+/*
+ * Character classes
+ */
+
+/* Preprocessor macros to use as building blocks in character
+ * classes. C handily allows us to concatenate constant strings to
+ * form a longer string, so by using preprocessor macros we can simply
+ * concatenate the names of these "subclasses" to form character
+ * classes. */
+#define UPPERS "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+#define LOWERS "abcdefghijklmnopqrstuvwxyz"
+#define DIGITS "0123456789"
+#define NEWLNS "\n\r"
+#define WHITES " \t"
+
+/* The character classes, as bits of the character class table. A
+ * class may be a union of several of these. */
+#define EOLS          0x01
+#define WHITESPACE    0x02
+#define BODYCHARS     0x04
+#define SYMSTARTCHARS 0x08
+#define DIGITCHARS    0x10
+#define BLANKLINES    (WHITESPACE | EOLS)
+
+/*
+ * setclass -- add characters to a class in the character class table
+ *
+ * chars -- the characters
+ * class -- the class
+ */
+static void setclass(struct parser *p, const char *chars, int class)
+{
+    for(; *chars; chars++) p->class[(unsigned char)*chars] |= class;
+}
+
+/*
+ * initclasses -- fill the character class table
+ */
+static void initclasses(struct parser *p)
+{
+    memset(p->class, 0, sizeof(p->class));
+    setclass(p, NEWLNS, EOLS);
+    setclass(p, WHITES, WHITESPACE);
+    setclass(p, UPPERS LOWERS DIGITS "_", BODYCHARS);
+    setclass(p, UPPERS LOWERS, SYMSTARTCHARS);
+    setclass(p, DIGITS, DIGITCHARS);
+}
 
 /*
  * Character reading
  */
 
 /*
- * readchar -- read the next character (really a byte) from the input stream
+ * refill -- read the next block of the input stream
  *
- * return value -- the character, either character value 0..255 or EOF
+ * return value -- nonzero if anything was read, zero at end of file
  *
  * Dies on read error. Note that since we use null-terminated strings
  * to store tokens, we must not allow null bytes as part of the input.
  */
-static int readchar(void)
+static int refill(struct parser *p)
 {
-    int ch;
+    p->pos = 0;
+    p->len = fread(p->block, 1, BLOCKSIZE, p->input);
+    if(ferror(p->input)) die("cannot read from input file");
+    if(memchr(p->block, 0, p->len)) die("null byte in input");
+    return(p->len != 0);
+}
 
-    ch = fgetc(input);
-    if(ferror(input)) die("cannot read from input file");
-    if(!ch) die("null byte in input");
-    return(ch);
+/*
+ * peekchar -- look at the next character (really a byte) of the input
+ * stream without reading it
+ *
+ * return value -- the character, either character value 0..255 or EOF
+ */
+static int peekchar(struct parser *p)
+{
+    if((p->pos == p->len) && !refill(p)) return(EOF);
+    return(p->block[p->pos]);
 }
 
 /*
@@ -56,31 +141,30 @@ static int readchar(void)
  * goal -- the goal character to be tested against
  * return value -- if the next character equaled goal, that character. Otherwise zero.
  */
-static int maybereadthechar(int goal)
+static int maybereadthechar(struct parser *p, int goal)
 {
     int ch;
 
-    ch = readchar();
-    if(ch == goal) return(ch);
-    ungetc(ch, input);
-    return(0);
+    ch = peekchar(p);
+    if(ch != goal) return(0);
+    if(ch != EOF) p->pos++;
+    return(ch);
 }
 
 /*
  * maybereadcharin -- read the next character from the input stream if it appears in goal
  *
- * goal -- the character class (a string of the characters that are
- * part of the class) to be tested against
+ * goal -- the character class to be tested against
  * return value -- if the next character was part of the class, that character. Otherwise zero.
  */
-static int maybereadcharin(const char *goal)
+static int maybereadcharin(struct parser *p, int goal)
 {
     int ch;
 
-    ch = readchar();
-    if(strchr(goal, ch)) return(ch);
-    ungetc(ch, input);
-    return(0);
+    ch = peekchar(p);
+    if((ch == EOF) || !(p->class[ch] & goal)) return(0);
+    p->pos++;
+    return(ch);
 }
 
 /*
@@ -91,26 +175,30 @@ static int maybereadcharin(const char *goal)
  * This function is used to skip whitespace or blank lines between
  * tokens.
  */
-static void skip(const char *goal)
+static void skip(struct parser *p, int goal)
 {
-    while(maybereadcharin(goal));
+    do
+    {
+        while((p->pos < p->len) && (p->class[p->block[p->pos]] & goal)) p->pos++;
+    }
+    while((p->pos == p->len) && refill(p));
 }
 
 /*
- * readintobuf -- read a token into the static token buffer buf
+ * readintobuf -- read a token into the token buffer buf
  *
  * firstch -- first character of the token, assumed to already have
  * been read by the caller
  * tailgoal -- character class into which characters comprising the
  * rest of the token must belong
  *
- * Reads the next token, one or more characters long, into the static
+ * Reads the next token, one or more characters long, into the
  * token buffer buf. buf is guaranteed to be null-terminated upon exit
  * from this function. buf is of fixed size; this function dies if the
  * size is exceeded without seeing the end of the token. Truncated
  * tokens are never returned.
  */
-static void readintobuf(int firstch, const char *tailgoal)
+static void readintobuf(struct parser *p, int firstch, int tailgoal)
 {
     size_t n;
     int ch;
@@ -120,35 +208,17 @@ static void readintobuf(int firstch, const char *tailgoal)
     for(;;)
     {
         if(n >= MAXTOKLEN) die("input token too long");
-        buf[n++] = ch;
-        ch = maybereadcharin(tailgoal);
+        p->buf[n++] = ch;
+        ch = maybereadcharin(p, tailgoal);
         if(!ch) break;
     }
-    buf[n] = 0;
+    p->buf[n] = 0;
 }
 
 /*
  * Tokenizer
  */
 
-/* Preprocessor macros to use as building blocks in character
- * classes. C handily allows us to concatenate constant strings to
- * form a longer string, so by using preprocessor macros we can simply
- * concatenate the names of these "subclasses" to form character
- * classes. */
-#define UPPERS "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-#define LOWERS "abcdefghijklmnopqrstuvwxyz"
-#define DIGITS "0123456789"
-#define NEWLNS "\n\r"
-#define WHITES " \t"
-
-static const char *eols          = NEWLNS;
-static const char *blanklines    = WHITES NEWLNS;
-static const char *whitespace    = WHITES;
-static const char *bodychars     = UPPERS LOWERS DIGITS "_";
-static const char *symstartchars = UPPERS LOWERS;
-static const char *digits        = DIGITS;
-
 /*
  * The following reading functions each read a single token of the
  * indicated type from the input stream. All except those with "maybe"
@@ -158,10 +228,10 @@ static const char *digits        = DIGITS;
 /*
  * readeof -- read end of file or die
  */
-static void readeof(void)
+static void readeof(struct parser *p)
 {
-    skip(blanklines);
-    if(!maybereadthechar(EOF)) die("end of file expected");
+    skip(p, BLANKLINES);
+    if(!maybereadthechar(p, EOF)) die("end of file expected");
 }
 
 /*
@@ -169,11 +239,11 @@ static void readeof(void)
  *
  * Note all following blank lines are consumed.
  */
-static void readeol(void)
+static void readeol(struct parser *p)
 {
-    skip(whitespace);
-    if(!maybereadthechar(EOF) && !maybereadcharin(eols)) die("end of line expected");
-    skip(blanklines);
+    skip(p, WHITESPACE);
+    if(!maybereadthechar(p, EOF) && !maybereadcharin(p, EOLS)) die("end of line expected");
+    skip(p, BLANKLINES);
 }
 
 /*
@@ -183,30 +253,30 @@ static void readeol(void)
  *
  * Note all following blank lines are consumed.
  */
-static void readkeyword(char *keyword)
+static void readkeyword(struct parser *p, char *keyword)
 {
-    skip(blanklines);
-    if(!maybereadthechar('_')) die("keyword expected");
-    readintobuf('_', bodychars);
-    if(strcmp(buf, keyword)) die("different keyword expected");
-    skip(blanklines);
+    skip(p, BLANKLINES);
+    if(!maybereadthechar(p, '_')) die("keyword expected");
+    readintobuf(p, '_', BODYCHARS);
+    if(strcmp(p->buf, keyword)) die("different keyword expected");
+    skip(p, BLANKLINES);
 }
 
 /*
  * maybereadsym -- read a symbol or return zero
  *
  * return value -- If the next token in the stream is a symbol, a
- * pointer to the static token buffer buf, which is guaranteed to
+ * pointer to the token buffer buf, which is guaranteed to
  * contain a null-terminated string. Otherwise a null pointer.
  */
-static char *maybereadsym(void)
+static char *maybereadsym(struct parser *p)
 {
     int ch;
 
-    skip(whitespace);
-    if(!(ch = maybereadcharin(symstartchars))) return(0);
-    readintobuf(ch, bodychars);
-    return(buf);
+    skip(p, WHITESPACE);
+    if(!(ch = maybereadcharin(p, SYMSTARTCHARS))) return(0);
+    readintobuf(p, ch, BODYCHARS);
+    return(p->buf);
 }
 
 /*
@@ -223,24 +293,32 @@ static char *maybereadsym(void)
  * the same number of bits as size_t. This assumes the underlying C
  * implementation uses two's complement.
  */
-static size_t readsize(size_t min, size_t max)
+static size_t readsize(struct parser *p, size_t min, size_t max)
 {
-    size_t val;
-    char *digit;
+    size_t val, digit, ndigit;
     int ch;
     int sign;
 
-    skip(whitespace);
+    skip(p, WHITESPACE);
     val = 0;
-    digit = 0;
-    sign = maybereadthechar('-') ? 1 : 0; /* negative number? */
-    while((ch = maybereadcharin(digits)))
+    ndigit = 0;
+    sign = maybereadthechar(p, '-') ? 1 : 0; /* negative number? */
+    do
     {
-        if(!(digit = strchr(digits, ch))) die("syntax error");
-        val = size_mul(val, 10);
-        val = size_add(val, digit-digits);
+        /* Scan the digits in the block directly. val*10 + digit
+         * overflows exactly when val is past these bounds, which the
+         * compiler folds into constants. */
+        for(; (p->pos < p->len) && (p->class[ch = p->block[p->pos]] & DIGITCHARS); p->pos++)
+        {
+            digit = ch - '0';
+            if((val > SIZE_MAX/10) || ((val == SIZE_MAX/10) && (digit > SIZE_MAX%10)))
+                die("integer overflow");
+            val = val*10 + digit;
+            ndigit++;
+        }
     }
-    if(!digit) die("integer expected"); /* did we actually read any digits? if not, die. */
+    while((p->pos == p->len) && refill(p));
+    if(!ndigit) die("integer expected"); /* did we actually read any digits? if not, die. */
     if(sign)
     {
         /* The upper bound here comes from the definition of the two's
@@ -280,20 +358,20 @@ static size_t readsize(size_t min, size_t max)
  * ...
  * <wordn>
  */
-static void readdump(size_t *out_off, size_t *out_size)
+static void readdump(struct parser *p, size_t *out_off, size_t *out_size)
 {
     size_t off, size, last, i;
 
-    off = readsize(memsize, memsize);
-    last = readsize(off, SIZE_MAX-1);
-    readeol();
+    off = readsize(p, p->m->memsize, p->m->memsize);
+    last = readsize(p, off, SIZE_MAX-1);
+    readeol(p);
 
     size = (last-off)+1;
-    addmem(size);
+    addmem(p->m, size);
     for(i=off; i<=last; i++)
     {
-        mem[i] = readsize(0, SIZE_MAX);
-        readeol();
+        p->m->mem[i] = readsize(p, 0, SIZE_MAX);
+        readeol(p);
     }
 
     *out_off = off;
@@ -316,43 +394,49 @@ static void readdump(size_t *out_off, size_t *out_size)
  * better to state the count of symbols in the file before the symbols
  * themselves.
  */
-static void readsymtab(void)
+static void readsymtab(struct parser *p)
 {
     char *sym;
 
-    while((sym = maybereadsym()))
+    while((sym = maybereadsym(p)))
     {
-        addsym(sym, readsize(0, SIZE_MAX));
-        readeol();
+        addsym(p->m, sym, readsize(p, 0, SIZE_MAX));
+        readeol(p);
     }
 }
 
 /*
  * readinput -- read a .b91 file from the input stream, storing the
- * results in the global memory array.
+ * results in the parser's machine.
  */
-static void readinput(void)
+static void readinput(struct parser *p)
 {
-    readkeyword("___b91___");
-    readkeyword("___code___");
-    readdump(&codeoff, &codesize);
-    readkeyword("___data___");
-    readdump(&dataoff, &datasize);
-    readkeyword("___symboltable___");
-    readsymtab();
-    readkeyword("___end___");
-    readeof();
+    readkeyword(p, "___b91___");
+    readkeyword(p, "___code___");
+    readdump(p, &p->m->codeoff, &p->m->codesize);
+    readkeyword(p, "___data___");
+    readdump(p, &p->m->dataoff, &p->m->datasize);
+    readkeyword(p, "___symboltable___");
+    readsymtab(p);
+    readkeyword(p, "___end___");
+    readeof(p);
 }
 
 /*
- * parsefile -- read a .b91 file from the named file into the global
- * memory array
+ * parsefile -- read a .b91 file from the named file into the memory
+ * of a machine
  *
+ * m -- the machine
  * filename -- the name of the file
  */
-void parsefile(char *filename)
+void parsefile(struct machine *m, char *filename)
 {
-    if(!(input = fopen(filename, "rb"))) die("cannot open input file");
-    readinput();
-    if(fclose(input)) die("cannot close input file");
+    struct parser ps, *p = &ps;
+
+    p->m = m;
+    p->pos = p->len = 0;
+    initclasses(p);
+    if(!(p->input = fopen(filename, "rb"))) die("cannot open input file");
+    readinput(p);
+    if(fclose(p->input)) die("cannot close input file");
 }
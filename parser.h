@@ -1,4 +1,4 @@
 /* Parser for the .b91 file format that describes pre-assembled TTK-91
  * programs. */
 
-void parsefile(char *filename);
+void parsefile(struct machine *m, char *filename);
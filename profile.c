@@ -0,0 +1,294 @@
+/* Execution profiler. Counts how often each instruction is executed
+ * and each memory word is accessed, and writes a report of the hot
+ * spots when the program halts.
+ *
+ * The counters are plain arrays indexed by address, as large as the
+ * memory, so counting costs an increment per event and no lookups.
+ * Memory does not grow while the program runs, so the arrays are
+ * sized once when profiling starts. Profiling is done by the
+ * reference engine, see simulate().
+ *
+ * Memory reads count operand fetches and pops, not instruction
+ * fetches, which the per-instruction counts already tell about. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "insn.h"
+#include "sym.h"
+#include "disasm.h"
+#include "profile.h"
+
+/* How many entries each list of the report shows at most */
+#define TOPN 20
+
+/* The counters */
+struct profile
+{
+    size_t size; /* entries in each of the arrays below */
+    size_t *execs; /* executions of the instruction at each address */
+    size_t *taken; /* taken jumps at each address */
+    size_t *calls; /* CALLs to each address */
+    size_t *reads; /* reads of each memory word */
+    size_t *writes; /* writes of each memory word */
+    size_t opcodes[256]; /* executions of each opcode */
+    size_t total; /* instructions executed */
+};
+
+/* An entry of a list in the report */
+struct hot
+{
+    size_t count;
+    size_t addr;
+};
+
+/*
+ * xcalloc -- allocate a zeroed counter array or die
+ *
+ * n -- count of counters
+ * return value -- the array
+ */
+static size_t *xcalloc(size_t n)
+{
+    size_t *p;
+
+    if(!(p = calloc(n, sizeof(size_t)))) die("out of memory");
+    return(p);
+}
+
+/*
+ * startprofile -- start counting what a computer does
+ *
+ * m -- the computer, with its memory at its final size
+ */
+void startprofile(struct machine *m)
+{
+    struct profile *p;
+
+    if(!(p = calloc(1, sizeof(*p)))) die("out of memory");
+    p->size = m->memsize;
+    p->execs = xcalloc(p->size);
+    p->taken = xcalloc(p->size);
+    p->calls = xcalloc(p->size);
+    p->reads = xcalloc(p->size);
+    p->writes = xcalloc(p->size);
+    m->profile = p;
+}
+
+/*
+ * countinsn -- count an instruction just executed
+ *
+ * m -- the computer, whose pc now points to the next instruction
+ * pc -- the address of the instruction
+ * insn -- the instruction
+ */
+void countinsn(struct machine *m, size_t pc, struct dinsn *insn)
+{
+    struct profile *p = m->profile;
+
+    p->total++;
+    p->execs[pc]++;
+    p->opcodes[insn->opcode]++;
+    if((insn->opcode >= 0x20) && (insn->opcode <= 0x2C) && (m->pc != pc+1)) p->taken[pc]++;
+    if((insn->opcode == 0x31) && (m->pc < p->size)) p->calls[m->pc]++;
+}
+
+/*
+ * countread -- count a read of a memory word
+ *
+ * m -- the computer
+ * addr -- the address of the word, which may be invalid
+ */
+void countread(struct machine *m, size_t addr)
+{
+    if(addr < m->profile->size) m->profile->reads[addr]++;
+}
+
+/*
+ * countwrite -- count a write of a memory word
+ *
+ * m -- the computer
+ * addr -- the address of the word, which may be invalid
+ */
+void countwrite(struct machine *m, size_t addr)
+{
+    if(addr < m->profile->size) m->profile->writes[addr]++;
+}
+
+/*
+ * cmphot -- qsort() comparison function ordering report entries from
+ * the largest count down, and those with equal counts by address
+ */
+static int cmphot(const void *a, const void *b)
+{
+    const struct hot *x = a, *y = b;
+
+    if(x->count != y->count) return((x->count > y->count) ? -1 : 1);
+    return((x->addr < y->addr) ? -1 : (x->addr > y->addr));
+}
+
+/*
+ * tophot -- find the largest nonzero counts
+ *
+ * counts -- the counters
+ * more -- counters to add to them, or a null pointer
+ * n -- count of counters
+ * out_n -- pointer to output parameter into which the count of
+ * entries returned is stored, at most TOPN
+ * return value -- malloc'ed array of the entries, largest first
+ */
+static struct hot *tophot(size_t *counts, size_t *more, size_t n, size_t *out_n)
+{
+    struct hot *hot;
+    size_t i, k;
+
+    if(!(hot = malloc(size_mul(n ? n : 1, sizeof(*hot))))) die("out of memory");
+    for(i=k=0; i<n; i++)
+    {
+        hot[k].count = counts[i] + (more ? more[i] : 0);
+        hot[k].addr = i;
+        if(hot[k].count) k++;
+    }
+    qsort(hot, k, sizeof(*hot), cmphot);
+    *out_n = (k < TOPN) ? k : TOPN;
+    return(hot);
+}
+
+/*
+ * area -- tell which area of memory an address lies in
+ *
+ * m -- the computer
+ * addr -- the address
+ * return value -- 1 for the code area, 2 for the data area, 0 for
+ * anywhere else
+ */
+static int area(struct machine *m, size_t addr)
+{
+    if((addr >= m->codeoff) && (addr-m->codeoff < m->codesize)) return(1);
+    if((addr >= m->dataoff) && (addr-m->dataoff < m->datasize)) return(2);
+    return(0);
+}
+
+/*
+ * putsym -- write the symbol nearest below an address, as <sym> or
+ * <sym+offset>
+ *
+ * m -- the computer
+ * f -- the output stream
+ * addr -- the address
+ *
+ * Nothing is written unless the symbol is in the same area as the
+ * address, so stack addresses are not named after the last data word.
+ * The names of ports and supervisor calls are not taken for labels.
+ */
+static void putsym(struct machine *m, FILE *f, size_t addr)
+{
+    struct syment *ent;
+
+    if(!(ent = nearestlabel(m, addr)) || !area(m, addr) || (area(m, ent->off) != area(m, addr))) return;
+    if(ent->off == addr) fprintf(f, " <%s>", ent->sym);
+    else fprintf(f, " <%s+%zu>", ent->sym, addr-ent->off);
+}
+
+/*
+ * percent -- compute a percentage of the instructions executed
+ */
+static double percent(struct profile *p, size_t count)
+{
+    return(p->total ? 100.0*count/p->total : 0.0);
+}
+
+/*
+ * endprofile -- write the profile report and stop counting
+ *
+ * m -- the computer
+ * filename -- the name of the file to write the report to
+ *
+ * The report lists the most executed instructions, disassembled, the
+ * opcode mix, the most called addresses and the most accessed memory
+ * words.
+ */
+void endprofile(struct machine *m, char *filename)
+{
+    struct profile *p = m->profile;
+    struct insn insn;
+    struct hot *hot;
+    FILE *f, *out;
+    size_t i, n;
+
+    if(!(f = fopen(filename, "w"))) dies("cannot open profile file", filename);
+    fprintf(f, "%zu instructions executed\n", p->total);
+
+    /* disasmword() writes to the computer's output stream */
+    out = m->out;
+    m->out = f;
+    fprintf(f, "\nHot instructions:\n");
+    fprintf(f, "%12s %6s %12s  instruction\n", "count", "%", "taken");
+    hot = tophot(p->execs, 0, p->size, &n);
+    for(i=0; i<n; i++)
+    {
+        fprintf(f, "%12zu %6.2f ", hot[i].count, percent(p, hot[i].count));
+        if(p->taken[hot[i].addr]) fprintf(f, "%12zu  ", p->taken[hot[i].addr]);
+        else fprintf(f, "%12s  ", "");
+        disasmword(m, hot[i].addr, m->mem[hot[i].addr]);
+        putsym(m, f, hot[i].addr);
+        fprintf(f, "\n");
+    }
+    free(hot);
+    m->out = out;
+
+    fprintf(f, "\nOpcode mix:\n");
+    hot = tophot(p->opcodes, 0, 256, &n);
+    for(i=0; i<n; i++)
+    {
+        decode(&insn, hot[i].addr << 24);
+        fprintf(f, "%12zu %6.2f  %s\n", hot[i].count, percent(p, hot[i].count),
+                *insn.mnemonic ? insn.mnemonic : "(invalid)");
+    }
+    free(hot);
+
+    hot = tophot(p->calls, 0, p->size, &n);
+    if(n)
+    {
+        fprintf(f, "\nCalls:\n");
+        fprintf(f, "%12s  target\n", "count");
+    }
+    for(i=0; i<n; i++)
+    {
+        fprintf(f, "%12zu  %zu", hot[i].count, hot[i].addr);
+        putsym(m, f, hot[i].addr);
+        fprintf(f, "\n");
+    }
+    free(hot);
+
+    hot = tophot(p->reads, p->writes, p->size, &n);
+    if(n)
+    {
+        fprintf(f, "\nHot data:\n");
+        fprintf(f, "%12s %12s  address\n", "reads", "writes");
+    }
+    for(i=0; i<n; i++)
+    {
+        fprintf(f, "%12zu %12zu  %zu", p->reads[hot[i].addr], p->writes[hot[i].addr], hot[i].addr);
+        putsym(m, f, hot[i].addr);
+        fprintf(f, "\n");
+    }
+    free(hot);
+
+    if(ferror(f)) die("cannot write to profile file");
+    if(fclose(f)) die("cannot close profile file");
+    free(p->execs);
+    free(p->taken);
+    free(p->calls);
+    free(p->reads);
+    free(p->writes);
+    free(p);
+    m->profile = 0;
+}
@@ -0,0 +1,12 @@
+/* Execution profiler. Counts how often each instruction is executed
+ * and each memory word is accessed, and writes a report of the hot
+ * spots when the program halts. */
+
+struct machine;
+struct dinsn;
+
+void startprofile(struct machine *m);
+void countinsn(struct machine *m, size_t pc, struct dinsn *insn);
+void countread(struct machine *m, size_t addr);
+void countwrite(struct machine *m, size_t addr);
+void endprofile(struct machine *m, char *filename);
@@ -1,18 +1,20 @@
-/* This module defines and provides access to the eight general
- * purpose registers of the TTK-91 computer. When we talk about
- * register numbers, we mean the ones encoded in the Ri and Rj fields
- * in TTK-91 instruction words. The TTK-91 computer's four control
- * registers are internal to the simulator module and are not dealt
- * with here. */
+/* This module provides access to the eight general purpose registers
+ * of the TTK-91 computer, which are kept in struct machine. When we
+ * talk about register numbers, we mean the ones encoded in the Ri and
+ * Rj fields in TTK-91 instruction words. The TTK-91 computer's four
+ * control registers are internal to the simulator module and are not
+ * dealt with here. */
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "die.h"
+#include "word.h"
+#include "machine.h"
 #include "reg.h"
 
-/* Value of each general-purpose register in the simulated computer */
-size_t regs[8];
-
 /* Table mapping register numbers to register names */
 const char *regnames[8] = {"R0", "R1", "R2", "R3", "R4", "R5", "SP", "FP"};
 
@@ -34,26 +36,30 @@ void checkreg(size_t reg)
 /*
  * getreg -- fetch the word in the register with the given number
  *
+ * m -- the computer
  * reg -- the register number
  *
  * Dies if the register number is invalid.
  */
-size_t getreg(size_t reg)
+word_t getreg(struct machine *m, size_t reg)
 {
     checkreg(reg);
-    return(regs[reg]);
+    return(m->regs[reg]);
 }
 
 /*
  * setreg -- store the given word in the register with the given number
  *
+ * m -- the computer
  * reg -- the register number
  * word -- the word to store
  *
- * Dies if the register number is invalid.
+ * Dies if the register number is invalid. The register number is
+ * remembered for the execution trace.
  */
-void setreg(size_t reg, size_t word)
+void setreg(struct machine *m, size_t reg, word_t word)
 {
     checkreg(reg);
-    regs[reg] = word;
+    m->regs[reg] = word;
+    m->lastreg = reg;
 }
@@ -0,0 +1,205 @@
+/* Server mode. Loads a program once and then runs it once per request,
+ * each time on the same computer, reset after every run to the state
+ * it had when loaded, so that running a short program on many inputs
+ * doesn't pay for loading it every time. The reset only restores the
+ * memory pages the run has written (see resetmem() in mem.c), so its
+ * cost does not depend on the size of the program.
+ *
+ * Requests are read from standard input, or from the clients of a Unix
+ * socket, one per line. A request is the input of a run: the words the
+ * program reads, as decimal integers separated by white space. Each
+ * request is answered with a line of JSON on the same connection,
+ *
+ * {"run":N,"exit":S,"output":"...","error":"..."}
+ *
+ * where N counts the runs from 1, S is the exit status ckone would
+ * have exited with (0, 1, or LIMITSTATUS), the output is everything the
+ * program wrote (the "Input:" prompts, the "Output:" lines and the
+ * final "HALT"), and the error message is only there if the run
+ * error-exited. Runs are done one at a time, in the order the requests
+ * come in. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "image.h"
+#include "sim.h"
+#include "io.h"
+#include "batch.h"
+#include "server.h"
+
+/* One run. Holds everything the run allocates, so that it can be
+ * cleaned up even if the run dies. */
+struct run
+{
+    struct machine *m; /* the computer with the program loaded */
+    char *input; /* the request */
+    size_t inputlen; /* length in bytes of the request */
+    char *out; /* the program's output */
+    size_t outlen;
+};
+
+/* Count of runs done so far */
+static size_t nrun;
+
+/*
+ * runrequest -- set up a computer for a request and run it. Called
+ * through catchdie().
+ *
+ * arg -- the run
+ */
+static void runrequest(void *arg)
+{
+    struct run *r = arg;
+    struct machine *m = r->m;
+
+    if(!(m->in = fmemopen(r->input, r->inputlen, "r"))) die("out of memory");
+    if(!(m->out = open_memstream(&r->out, &r->outlen))) die("out of memory");
+    simulate(m);
+}
+
+/*
+ * answer -- run the program on one request, write the answer and reset
+ * the computer for the next request
+ *
+ * m -- the computer with the program loaded and its state kept
+ * input -- the request, which must not be empty
+ * len -- length in bytes of the request
+ * f -- the stream to write the answer to
+ * return value -- zero if the answer was written, nonzero if writing
+ * it failed, as when the client has gone away
+ */
+static int answer(struct machine *m, char *input, size_t len, FILE *f)
+{
+    struct run r;
+    char *error;
+    int status;
+
+    memset(&r, 0, sizeof(r));
+    r.m = m;
+    r.input = input;
+    r.inputlen = len;
+    m->in = m->out = 0;
+    status = 0;
+    if((error = catchdie(runrequest, &r))) status = caughtstatus();
+    if(error && m->out) flushio(m);
+    if(m->in) fclose(m->in);
+    if(m->out) fclose(m->out);
+    reset(m);
+
+    fprintf(f, "{\"run\":%zu,\"exit\":%d,\"output\":", ++nrun, status);
+    putjson(f, r.out ? r.out : "");
+    if(error)
+    {
+        fprintf(f, ",\"error\":");
+        putjson(f, error);
+    }
+    fprintf(f, "}\n");
+    fflush(f);
+
+    free(r.out);
+    return(ferror(f));
+}
+
+/*
+ * session -- answer the requests coming from a stream until it ends
+ * or an answer cannot be written
+ *
+ * m -- the computer with the program loaded and its state kept
+ * in -- the stream to read requests from
+ * out -- the stream to write answers to
+ */
+static void session(struct machine *m, FILE *in, FILE *out)
+{
+    char *line = 0;
+    size_t cap = 0;
+    ssize_t len;
+
+    while((len = getline(&line, &cap, in)) > 0)
+        if(answer(m, line, len, out)) break;
+    free(line);
+}
+
+/*
+ * listento -- answer the requests of the clients of a Unix socket, one
+ * client at a time, forever
+ *
+ * m -- the computer with the program loaded and its state kept
+ * path -- the file name of the socket to create. A socket left there
+ * by an earlier server is replaced.
+ *
+ * A client that goes away before reading its answers only ends its own
+ * session, since SIGPIPE is ignored and the failed write is noticed.
+ */
+static void listento(struct machine *m, char *path)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    FILE *in, *out = 0;
+    int s, c;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    if(sigaction(SIGPIPE, &sa, 0)) die("cannot install signal handler");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) dies("socket name too long:", path);
+    strcpy(addr.sun_path, path);
+    if((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) die("cannot create socket");
+    if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+    if(bind(s, (struct sockaddr *)&addr, sizeof(addr))) dies("cannot bind socket", path);
+    if(listen(s, 16)) dies("cannot listen on socket", path);
+    for(;;)
+    {
+        if((c = accept(s, 0, 0)) == -1)
+        {
+            /* Running out of file descriptors or memory may pass, so
+             * wait a while instead of retrying at once */
+            if((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) || (errno == ENOMEM)) sleep(1);
+            else if((errno != EINTR) && (errno != ECONNABORTED)) dies("cannot accept connection on socket", path);
+            continue;
+        }
+        if(!(in = fdopen(c, "r"))) die("cannot open connection");
+        if(((c = dup(c)) == -1) || !(out = fdopen(c, "w"))) die("cannot open connection");
+        session(m, in, out);
+        fclose(in);
+        fclose(out);
+    }
+}
+
+/*
+ * serve -- load a program and run it once per request
+ *
+ * program -- the name of the .b91 or image file
+ * path -- the file name of a Unix socket to listen on, or a null
+ * pointer to answer requests from standard input on standard output
+ * return value -- the exit status for ckone
+ */
+int serve(char *program, char *path)
+{
+    struct machine m;
+
+    initmachine(&m);
+    loadfile(&m, program);
+    startstack(&m);
+    keepstate(&m);
+    if(path) listento(&m, path);
+    else session(&m, stdin, stdout);
+    freemachine(&m);
+    return(0);
+}
@@ -0,0 +1,5 @@
+/* Server mode. Loads a program once and then runs it once per request,
+ * each time on a fresh copy of the memory it had when loaded, and
+ * answers each request with a line of JSON. */
+
+int serve(char *program, char *path);
@@ -2,21 +2,37 @@
  * and memory management are done in other modules, this one actually
  * simulates the CPU logic. */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "size.h"
 #include "die.h"
+#include "word.h"
+#include "machine.h"
 #include "mem.h"
 #include "reg.h"
 #include "insn.h"
+#include "icache.h"
 #include "disasm.h"
+#include "trace.h"
+#include "profile.h"
+#include "io.h"
+#include "dev.h"
+#include "iolog.h"
+#include "snap.h"
+#include "cpu.h"
 #include "ckone.h"
 #include "sim.h"
+#include "threaded.h"
+#include "jit.h"
 
 /* This macro gives the number of elements in xs, where xs is the name
  * of any fixed-size array whose size has been declared in the source
@@ -24,19 +40,79 @@
 #undef  COUNTOF
 #define COUNTOF(xs) (sizeof(xs)/sizeof(xs[0]))
 
-/* Bitmasks for state register bits, for use with bitwise operations */
-#define SR_L 2 /* Whether last numerical comparison produced "less than" */
-#define SR_E 1 /* Whether last numerical comparison produced "equal to" */
-#define SR_G 0 /* Whether last numerical comparison produced "greater than" */
+/* The computer that simulate() is running in this thread, for the
+ * SIGSEGV handler. */
+static THREADLOCAL struct machine *running;
 
-/* TTK-91 control registers */
-static size_t pc; /* Program counter */
-static size_t ir; /* Instruction register */
-static size_t tr; /* Temporary register */
-static size_t sr; /* State register */
+/*
+ * Memory faults
+ */
 
-/* Nonzero if the HALT supervisor call has been issued. */
-static int halted;
+/*
+ * badaddr -- die because of an invalid memory address
+ *
+ * m -- the computer
+ *
+ * The message includes the program counter, which points just past
+ * the offending instruction, or at the address that couldn't be
+ * fetched.
+ */
+void badaddr(struct machine *m)
+{
+    char msg[64];
+
+    sprintf(msg, "invalid memory address (pc %zu)", m->pc);
+    die(msg);
+}
+
+/*
+ * segv -- SIGSEGV handler
+ *
+ * Accesses to invalid memory addresses fault (see mem.h); those faults
+ * become error-exits. The faults happen synchronously inside getmem()
+ * and setmem(), never inside the C library, so it is safe enough to
+ * use stdio here, and to longjmp() out of the handler when die() is
+ * being caught (see batch.c). Any other fault gets the default
+ * treatment once the handler returns and the faulting instruction is
+ * retried.
+ */
+static void segv(int sig, siginfo_t *info, void *context)
+{
+    if(running && memfault(running, info->si_addr)) badaddr(running);
+    signal(SIGSEGV, SIG_DFL);
+}
+
+/*
+ * Data memory access
+ */
+
+/*
+ * load -- fetch a data word from memory, counting the read if
+ * profiling
+ *
+ * m -- the computer
+ * addr -- the address of the word
+ * return value -- the word
+ */
+static word_t load(struct machine *m, size_t addr)
+{
+    if(m->profile) countread(m, addr);
+    return(getmem(m, addr));
+}
+
+/*
+ * store -- store a data word in memory, counting the write if
+ * profiling
+ *
+ * m -- the computer
+ * addr -- the address of the word
+ * word -- the word
+ */
+static void store(struct machine *m, size_t addr, word_t word)
+{
+    if(m->profile) countwrite(m, addr);
+    setmem(m, addr, word);
+}
 
 /*
  * Stack operations
@@ -49,29 +125,31 @@ static int halted;
 /*
  * push -- push the given word on the given stack
  *
+ * m -- the computer
  * sp -- stack pointer register to use. Can be any of the eight
  * general purpose registers.
  * word -- the word to push on the stack
  */
-static void push(size_t sp, size_t word)
+static void push(struct machine *m, size_t sp, word_t word)
 {
-    setreg(sp, getreg(sp)+1);
-    setmem(getreg(sp), word);
+    setreg(m, sp, getreg(m, sp)+1);
+    store(m, getreg(m, sp), word);
 }
 
 /*
  * pop -- pop a word off the given stack
  *
+ * m -- the computer
  * sp -- stack pointer register to use. Can be any of the eight
  * general purpose registers.
  * return value -- the word popped off the stack
  */
-static size_t pop(size_t sp)
+static word_t pop(struct machine *m, size_t sp)
 {
-    size_t word;
+    word_t word;
 
-    word = getmem(getreg(sp));
-    setreg(sp, getreg(sp)-1);
+    word = load(m, getreg(m, sp));
+    setreg(m, sp, getreg(m, sp)-1);
     return(word);
 }
 
@@ -79,254 +157,552 @@ static size_t pop(size_t sp)
  * State register operations
  */
 
+/* The state register is evaluated lazily: COMP only records the words
+ * it compared, and the comparison bits are worked out from them when
+ * a conditional jump tests one, or when something needs the whole
+ * register (see getsr()). Most comparisons are only ever tested by
+ * the one jump that follows them. */
+
 /*
  * getsrbit -- get the given bit from the state register
  *
+ * m -- the computer
  * bit -- index of the bit to get, where 0 <= bit < SIZE_BIT
  * return value -- zero if the bit is false, nonzero otherwise
  */
-static size_t getsrbit(size_t bit)
+static size_t getsrbit(struct machine *m, size_t bit)
 {
-    return(!!(sr & (1<<bit)));
+    if(m->srlazy)
+        switch(bit)
+        {
+        case SR_L: return(WORD_LT(m->cmpa, m->cmpb));
+        case SR_E: return(m->cmpa == m->cmpb);
+        case SR_G: return(WORD_LT(m->cmpb, m->cmpa));
+        }
+    return(!!(m->sr & (1<<bit)));
 }
 
 /*
- * setsrbit -- set the value of the given bit in the state register
+ * getsr -- get the value of the state register
  *
- * bit -- index of the bit to set, where 0 <= bit < SIZE_BIT
- * val -- the boolean value to set it to, where nonzero is true
+ * m -- the computer
+ * return value -- the state register, which is also left in m->sr
+ *
+ * Anything that reads m->sr directly must call this first.
  */
-static void setsrbit(size_t bit, size_t val)
+word_t getsr(struct machine *m)
 {
-    if(val) sr |= (1<<bit); else sr &= ~(1<<bit);
+    if(m->srlazy)
+    {
+        m->sr = (m->sr & ~(word_t)((1<<SR_L) | (1<<SR_E) | (1<<SR_G)))
+              | ((word_t)WORD_LT(m->cmpa, m->cmpb) << SR_L)
+              | ((word_t)(m->cmpa == m->cmpb) << SR_E)
+              | ((word_t)WORD_LT(m->cmpb, m->cmpa) << SR_G);
+        m->srlazy = 0;
+    }
+    return(m->sr);
 }
 
 /*
  * compare -- compare two words and update the state register accordingly
  *
+ * m -- the computer
  * a -- the left-hand-side word
  * b -- the right-hand-side word
  */
-static void compare(size_t a, size_t b)
+static void compare(struct machine *m, word_t a, word_t b)
 {
-    setsrbit(SR_L, a<b);
-    setsrbit(SR_E, a==b);
-    setsrbit(SR_G, a>b);
+    m->cmpa = a;
+    m->cmpb = b;
+    m->srlazy = 1;
 }
 
-/* 
- * I/O device implementations
+/*
+ * Supervisor call implementations
  */
 
+/* Each takes as parameters the computer and the stack pointer
+ * register to use. That register is passed straight to the functions
+ * in the Stack operations section of this module. */
+
 /*
- * input -- read a signed decimal integer from standard input
- *
- * return value -- the unsigned word representation of the integer read
+ * retry -- in deterministic mode, give up the turn of a CPU that has
+ * to wait for another in a supervisor call, to do the call again in its
+ * next turn
  *
- * Dies on input error. Integer overflow checking not done.
+ * m -- the CPU
  */
-static size_t input(void)
+static void retry(struct machine *m)
 {
-    ssize_t ss;
-
-    printf("Input: ");
-    fflush(stdout);
-    if(scanf("%zd", &ss)!=1) die("cannot read from standard input");
-    if(ferror(stdin)) die("cannot read from standard input");
-    if(verbose) printf("Received input: %zd\n", ss);
-    return(ss);
+    m->pc--;
+    m->retired--;
+    m->yield = 1;
 }
 
-/*
- * output -- write a signed decimal integer to standard output
- *
- * val -- the unsigned word representation of the integer to write
- */
-static void output(size_t val)
+static void svc_halt(struct machine *m, size_t sp)
 {
-    printf("Output: %zd\n", (ssize_t)val);
-    fflush(stdout);
+    /* CPUs other than the first just stop, and the first waits for
+     * them (see cpu.c) */
+    if(m->cpu)
+    {
+        m->halted = 1;
+        return;
+    }
+    if(m->smp && !joinall(m))
+    {
+        retry(m);
+        return;
+    }
+    if(m->iolog) loghalt(m);
+    putstr(m, "HALT\n");
+    flushio(m);
+    m->halted = 1;
 }
 
-/* Table mapping port numbers to input device implementations (just C functions) */
-static size_t (*intab[])(void) = {0, input, 0, 0, 0, 0, input};
-
-/* Table mapping port numbers to output device implementations (just C functions) */
-static void (*outtab[])(size_t) = {output, 0, 0, 0, 0, 0, 0, output};
+static void svc_time(struct machine *m, size_t sp)
+{
+    die("TIME supervisor call not implemented");
+}
 
-/*
- * Supervisor call implementations
- */
+static void svc_date(struct machine *m, size_t sp)
+{
+    die("DATE supervisor call not implemented");
+}
 
-/* Each takes as a parameter the stack pointer register to use. That
- * register is passed straight to the functions in the Stack
- * operations section of this module. */
+static void svc_read(struct machine *m, size_t sp)
+{
+    store(m, pop(m, sp), devin(m, KBD));
+}
 
-static void svc_halt(size_t sp)
+static void svc_write(struct machine *m, size_t sp)
 {
-    printf("HALT\n");
-    fflush(stdout);
-    halted = 1;
+    devout(m, CRT, pop(m, sp));
 }
 
-static void svc_time(size_t sp)
+/* The supervisor calls for multiple CPUs, see cpu.c */
+
+static void svc_spawn(struct machine *m, size_t sp)
 {
-    die("TIME supervisor call not implemented");
+    word_t stack;
+    size_t pc;
+
+    stack = pop(m, sp);
+    pc = pop(m, sp);
+    push(m, sp, spawncpu(m, pc, stack));
 }
 
-static void svc_date(size_t sp)
+static void svc_join(struct machine *m, size_t sp)
 {
-    die("DATE supervisor call not implemented");
+    if(joincpu(m, load(m, getreg(m, sp)))) pop(m, sp);
+    else retry(m);
 }
 
-static void svc_read(size_t sp)
+static void svc_cas(struct machine *m, size_t sp)
 {
-    setmem(pop(sp), input());
+    word_t word, expect;
+    size_t addr;
+
+    word = pop(m, sp);
+    expect = pop(m, sp);
+    addr = pop(m, sp);
+    push(m, sp, casmem(m, addr, expect, word));
 }
 
-static void svc_write(size_t sp)
+static void svc_faa(struct machine *m, size_t sp)
 {
-    output(pop(sp));
+    word_t incr;
+    size_t addr;
+
+    incr = pop(m, sp);
+    addr = pop(m, sp);
+    push(m, sp, faamem(m, addr, incr));
 }
 
 /* Table mapping supervisor call numbers to their implementation (just
  * C functions). */
-static void (*svctab[])(size_t) =
+static void (*svctab[])(struct machine *, size_t) =
 {
     0, 0, 0, 0,
     0, 0, 0, 0,
     0, 0, 0, svc_halt,
     svc_read, svc_write, svc_time, svc_date,
+    svc_spawn, svc_join, svc_cas, svc_faa,
 };
 
+/*
+ * Resource limits
+ */
+
+/* How many instructions may be executed between checks of the clock.
+ * Reading the clock costs far more than executing an instruction. */
+#define CHECKINTERVAL ((size_t)1 << 20)
+
+/*
+ * now -- the time in seconds on the monotonic clock
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec/1e9);
+}
+
+/*
+ * startlimits -- arm the instruction and time limits for a run
+ *
+ * m -- the computer
+ */
+static void startlimits(struct machine *m)
+{
+    m->deadline = (timeout > 0) ? now()+timeout : 0;
+    m->nextcheck = (maxinsns || m->deadline) ? 0 : SIZE_MAX;
+}
+
+/*
+ * checklimits -- check whether a run has exceeded its instruction or
+ * time limit
+ *
+ * m -- the computer, whose retired count has reached nextcheck
+ *
+ * error-exits with LIMITSTATUS if it has; otherwise sets nextcheck to
+ * when to check again, and if the program has spawned CPUs, has
+ * checkcpus() see whether this one must stop or give up its turn.
+ *
+ * The engines only compare retired with nextcheck, and only at the
+ * ends of basic blocks, so that an idle limit costs next to nothing.
+ * A run may thus overshoot its instruction limit by the length of a
+ * block.
+ */
+void checklimits(struct machine *m)
+{
+    char msg[128];
+    char *what;
+
+    if(maxinsns && (m->retired >= maxinsns)) what = "instruction limit exceeded";
+    else if(m->deadline && (now() >= m->deadline)) what = "time limit exceeded";
+    else
+    {
+        m->nextcheck = m->retired + CHECKINTERVAL;
+        if(maxinsns && (m->nextcheck > maxinsns)) m->nextcheck = maxinsns;
+        if(m->smp) checkcpus(m);
+        return;
+    }
+    sprintf(msg, "%s (pc %zu, %zu instructions retired)", what, m->pc, m->retired);
+    dielimit(msg);
+}
+
 /*
  * Fetch-decode-execute cycle
  */
 
 /*
- * simulate -- execute the program one CPU instruction at a time until HALT
+ * execute -- execute a single pre-decoded instruction
+ *
+ * m -- the computer
+ * insn -- the instruction. The caller has already fetched it into ir
+ * and advanced pc past it.
  */
-void simulate(void)
+void execute(struct machine *m, struct dinsn *insn)
 {
-    struct insn *insn;
     size_t reg;
-    ssize_t tmp;
 
-    /* Before starting to run the program, establish a stack */
-    setreg(FP, memsize ? (memsize-1) : 0); /* initialize frame pointer */
-    setreg(SP, memsize); /* initialize stack pointer */
-    addmem(64); /* reserve memory for the stack at end of address space */
+    reg = insn->reg;
 
-    /* Each iteration of this loop executes one instruction */
-    while(!halted)
+    m->tr = insn->imm;
+    if(insn->idxreg) m->tr += getreg(m, insn->idxreg);
+
+    switch(insn->mode)
     {
-        /* Fetch the instruction word */
-        ir = getmem(pc);
-        if(verbose)
-        {
-            printf("Executing ");
-            disasm(mem, pc, 1);
-        }
-        pc++;
+    case 0: break;
+    case 1: m->tr = load(m, m->tr); break;
+    case 2: m->tr = load(m, load(m, m->tr)); break;
+    }
 
-        /* Decode the instruction word */
-        insn = decode(ir);
-        reg = insn->reg;
+    /* Execute the instruction */
+    switch(insn->opcode)
+    {
+    case 0x00: /*NOP*/
+        break;
+    case 0x01: /*STORE*/
+        store(m, m->tr, getreg(m, reg)); 
+        break;
+    case 0x02: /*LOAD*/
+        setreg(m, reg, m->tr);
+        break;
+    case 0x03: /*IN*/
+        setreg(m, reg, devin(m, m->tr));
+        break;
+    case 0x04: /*OUT*/
+        devout(m, m->tr, getreg(m, reg));
+        break;
+    case 0x11: setreg(m, reg, getreg(m, reg) + m->tr); break; /*ADD*/
+    case 0x12: setreg(m, reg, getreg(m, reg) - m->tr); break; /*SUB*/
+    case 0x13: setreg(m, reg, getreg(m, reg) * m->tr); break; /*MUL*/
+    case 0x14: setreg(m, reg, word_div(getreg(m, reg), m->tr)); break; /*DIV*/
+    case 0x15: setreg(m, reg, word_mod(getreg(m, reg), m->tr)); break; /*MOD*/
+    case 0x16: setreg(m, reg, getreg(m, reg) & m->tr); break; /*AND*/
+    case 0x17: setreg(m, reg, getreg(m, reg) | m->tr); break; /*OR*/
+    case 0x18: setreg(m, reg, getreg(m, reg) ^ m->tr); break; /*XOR*/
+    case 0x19: setreg(m, reg, word_shl(getreg(m, reg), m->tr)); break; /*SHL*/
+    case 0x1A: setreg(m, reg, word_shr(getreg(m, reg), m->tr)); break; /*SHR*/
+    case 0x1B: setreg(m, reg, word_sar(getreg(m, reg), m->tr)); break; /*SHRA*/
+    case 0x1F: compare(m, getreg(m, reg), m->tr); break; /*COMP*/
+    case 0x20: m->pc=m->tr; break; /*JUMP*/
+    case 0x21: if((sword_t)getreg(m, reg) < 0) m->pc=m->tr; break; /*JNEG*/
+    case 0x22: if((sword_t)getreg(m, reg) == 0) m->pc=m->tr; break; /*JZER*/
+    case 0x23: if((sword_t)getreg(m, reg) > 0) m->pc=m->tr; break; /*JPOS*/
+    case 0x24: if((sword_t)getreg(m, reg) >= 0) m->pc=m->tr; break; /*JNNEG*/
+    case 0x25: if((sword_t)getreg(m, reg) != 0) m->pc=m->tr; break; /*JNZER*/
+    case 0x26: if((sword_t)getreg(m, reg) <= 0) m->pc=m->tr; break; /*JNPOS*/
+    case 0x27: if(getsrbit(m, SR_L)) m->pc=m->tr; break; /*JLES*/
+    case 0x28: if(getsrbit(m, SR_E)) m->pc=m->tr; break; /*JEQU*/
+    case 0x29: if(getsrbit(m, SR_G)) m->pc=m->tr; break; /*JGRE*/
+    case 0x2A: if(!getsrbit(m, SR_L)) m->pc=m->tr; break; /*JNLES*/
+    case 0x2B: if(!getsrbit(m, SR_E)) m->pc=m->tr; break; /*JNEQU*/
+    case 0x2C: if(!getsrbit(m, SR_G)) m->pc=m->tr; break; /*JNGRE*/
+    case 0x31: /*CALL*/ 
+        push(m, reg, m->pc);
+        push(m, reg, getreg(m, FP));
+        setreg(m, FP, getreg(m, SP));
+        m->pc=m->tr;
+        break;
+    case 0x32: /*EXIT*/
+        setreg(m, FP, pop(m, reg));
+        m->pc = pop(m, reg);
+        for(; m->tr; m->tr--) pop(m, reg);
+        break;
+    case 0x33: /*PUSH*/
+        push(m, reg, m->tr);
+        break;
+    case 0x34: /*POP*/
+        setreg(m, insn->idxreg, pop(m, reg));
+        break;
+    case 0x35: /*PUSHR*/
+        push(m, reg, getreg(m, 0));
+        push(m, reg, getreg(m, 1));
+        push(m, reg, getreg(m, 2));
+        push(m, reg, getreg(m, 3));
+        push(m, reg, getreg(m, 4));
+        push(m, reg, getreg(m, 5));
+        break;
+    case 0x36: /*POPR*/
+        setreg(m, 5, pop(m, reg));
+        setreg(m, 4, pop(m, reg));
+        setreg(m, 3, pop(m, reg));
+        setreg(m, 2, pop(m, reg));
+        setreg(m, 1, pop(m, reg));
+        setreg(m, 0, pop(m, reg));
+        break;
+    case 0x70: /*SVC*/
+        if((m->tr >= COUNTOF(svctab)) || !svctab[m->tr]) die("no such supervisor call");
+        svctab[m->tr](m, reg);
+        break;
+    default:
+        die("bad instruction");
+    }
+}
 
-        tmp = (ssize_t)(int16_t)insn->imm;
-        if(insn->idxreg) tmp += (ssize_t)getreg(insn->idxreg);
-        tr = (size_t)tmp;
+/*
+ * startstack -- establish the stack of a program about to be run
+ *
+ * m -- the computer, with the program loaded
+ *
+ * Reserves memory for the stack at the end of the address space and
+ * points the frame and stack pointers at it, unless that has already
+ * been done, as it has for a program carrying on from a snapshot.
+ * simulate() does this itself; it is only needed before simulate() to
+ * keep the state of the computer with keepstate() stack and all.
+ */
+void startstack(struct machine *m)
+{
+    if(m->started) return;
+    setreg(m, FP, m->memsize ? (m->memsize-1) : 0); /* initialize frame pointer */
+    setreg(m, SP, m->memsize); /* initialize stack pointer */
+    addmem(m, 64); /* reserve memory for the stack at end of address space */
+    m->started = 1;
+}
+
+/*
+ * runcpu -- run a CPU until it halts
+ *
+ * m -- the CPU: the computer itself, or one it has spawned (see cpu.c)
+ *
+ * The instructions are executed by the engine selected on the command
+ * line. This function is the reference engine; the others must behave
+ * exactly like it. Verbose mode, tracing, profiling, taking a snapshot
+ * and deterministic mode always use the reference engine since the
+ * others do not trace or count or stop between any two instructions.
+ * Taking a snapshot ends the run.
+ *
+ * In deterministic mode, the first CPU lets the others take their
+ * turns whenever its own turn ends, and the others return at the end
+ * of their turns.
+ */
+void runcpu(struct machine *m)
+{
+    struct dinsn *insn;
+    size_t pc;
 
-        switch(insn->mode)
+    running = m;
+    if(!deterministic && !(verbose && !m->cpu) && !m->trace && !m->profile && !snapfile)
+    {
+        if(engine == ENGINE_THREADED)
+        {
+            simulate_threaded(m);
+            return;
+        }
+        if(engine == ENGINE_JIT)
         {
-        case 0: break;
-        case 1: tr = getmem(tr); break;
-        case 2: tr = getmem(getmem(tr)); break;
+            simulate_jit(m);
+            return;
         }
+    }
 
-        /* Execute the instruction */
-        switch(insn->opcode)
+    for(;;)
+    {
+        /* Each iteration of this loop executes one instruction */
+        while(!m->halted && !m->yield)
         {
-        case 0x00: /*NOP*/
-            break;
-        case 0x01: /*STORE*/
-            setmem(tr, getreg(reg)); 
-            break;
-        case 0x02: /*LOAD*/
-            setreg(reg, tr);
-            break;
-        case 0x03: /*IN*/
-            if((tr >= COUNTOF(intab)) || !intab[tr]) die("no such input device");
-            setreg(reg, intab[tr]());
-            break;
-        case 0x04: /*OUT*/
-            if((tr >= COUNTOF(outtab)) || !outtab[tr]) die("no such output device");
-            outtab[tr](getreg(reg));
-            break;
-        case 0x11: setreg(reg, getreg(reg) + tr); break; /*ADD*/
-        case 0x12: setreg(reg, getreg(reg) - tr); break; /*SUB*/
-        case 0x13: setreg(reg, getreg(reg) * tr); break; /*MUL*/
-        case 0x14: setreg(reg, getreg(reg) / tr); break; /*DIV*/
-        case 0x15: setreg(reg, getreg(reg) % tr); break; /*MOD*/
-        case 0x16: setreg(reg, getreg(reg) & tr); break; /*AND*/
-        case 0x17: setreg(reg, getreg(reg) | tr); break; /*OR*/
-        case 0x18: setreg(reg, getreg(reg) ^ tr); break; /*XOR*/
-        case 0x19: setreg(reg, getreg(reg) << tr); break; /*SHL*/
-        case 0x1A: setreg(reg, size_shr(getreg(reg), tr)); break; /*SHR*/
-        case 0x1B: setreg(reg, size_sar(getreg(reg), tr)); break; /*SHRA*/
-        case 0x1F: compare(getreg(reg), tr); break; /*COMP*/
-        case 0x20: pc=tr; break; /*JUMP*/
-        case 0x21: if((ssize_t)getreg(reg) < 0) pc=tr; break; /*JNEG*/
-        case 0x22: if((ssize_t)getreg(reg) == 0) pc=tr; break; /*JZER*/
-        case 0x23: if((ssize_t)getreg(reg) > 0) pc=tr; break; /*JPOS*/
-        case 0x24: if((ssize_t)getreg(reg) >= 0) pc=tr; break; /*JNNEG*/
-        case 0x25: if((ssize_t)getreg(reg) != 0) pc=tr; break; /*JNZER*/
-        case 0x26: if((ssize_t)getreg(reg) <= 0) pc=tr; break; /*JNPOS*/
-        case 0x27: if(getsrbit(SR_L)) pc=tr; break; /*JLES*/
-        case 0x28: if(getsrbit(SR_E)) pc=tr; break; /*JEQU*/
-        case 0x29: if(getsrbit(SR_G)) pc=tr; break; /*JGRE*/
-        case 0x2A: if(!getsrbit(SR_L)) pc=tr; break; /*JNLES*/
-        case 0x2B: if(!getsrbit(SR_E)) pc=tr; break; /*JNEQU*/
-        case 0x2C: if(!getsrbit(SR_G)) pc=tr; break; /*JNGRE*/
-        case 0x31: /*CALL*/ 
-            push(reg, pc);
-            push(reg, getreg(FP));
-            setreg(FP, getreg(SP));
-            pc=tr;
-            break;
-        case 0x32: /*EXIT*/
-            setreg(FP, pop(reg));
-            pc = pop(reg);
-            for(; tr; tr--) pop(reg);
-            break;
-        case 0x33: /*PUSH*/
-            push(reg, tr);
-            break;
-        case 0x34: /*POP*/
-            setreg(insn->idxreg, pop(reg));
-            break;
-        case 0x35: /*PUSHR*/
-            push(reg, getreg(0));
-            push(reg, getreg(1));
-            push(reg, getreg(2));
-            push(reg, getreg(3));
-            push(reg, getreg(4));
-            push(reg, getreg(5));
-            break;
-        case 0x36: /*POPR*/
-            setreg(5, pop(reg));
-            setreg(4, pop(reg));
-            setreg(3, pop(reg));
-            setreg(2, pop(reg));
-            setreg(1, pop(reg));
-            setreg(0, pop(reg));
-            break;
-        case 0x70: /*SVC*/
-            if((tr >= COUNTOF(svctab)) || !svctab[tr]) die("no such supervisor call");
-            svctab[tr](reg);
-            break;
-        default:
-            die("bad instruction");
+            if(snapfile && ((m->pc == snappc) || (m->retired == snapinsns)))
+            {
+                flushio(m);
+                writesnap(m, snapfile);
+                return;
+            }
+
+            /* Fetch the instruction word */
+            m->ir = getmem(m, m->pc);
+            if(verbose && !m->cpu)
+            {
+                fprintf(m->out, "Executing ");
+                disasm(m, m->pc, 1);
+            }
+
+            /* Decode the instruction word, unless the cache already has it */
+            insn = &m->icache[m->pc];
+            if(!insn->valid) predecode(insn, m->ir);
+            pc = m->pc++;
+
+            if(m->trace)
+            {
+                m->lastreg = 8;
+                m->lastwrite = SIZE_MAX;
+            }
+            execute(m, insn);
+            m->retired++;
+            if(m->trace) recordtrace(m, pc);
+            if(m->profile) countinsn(m, pc, insn);
+            if((m->pc != pc+1) && (m->retired >= m->nextcheck)) checklimits(m);
         }
+        if(m->halted || m->cpu) break;
+        taketurns(m);
+    }
+}
+
+/*
+ * runturn -- in deterministic mode, run a CPU other than the first until
+ * it halts or its turn ends (see cpu.c)
+ *
+ * m -- the CPU
+ */
+void runturn(struct machine *m)
+{
+    struct machine *first = running;
+
+    m->yield = 0;
+    runcpu(m);
+    running = first;
+}
+
+/*
+ * runcpuarg -- call runcpu() through catchdie()
+ *
+ * arg -- the computer
+ */
+void runcpuarg(void *arg)
+{
+    runcpu(arg);
+}
+
+/*
+ * stepcpu -- execute the single instruction at the program counter, as
+ * the reference engine does when not tracing or profiling
+ *
+ * m -- the CPU, made ready by startrun()
+ *
+ * Used by the lockstep engine (see lockstep.c) for the instructions it
+ * leaves to each computer on its own.
+ */
+void stepcpu(struct machine *m)
+{
+    struct dinsn *insn;
+    size_t pc;
+
+    running = m;
+    m->ir = getmem(m, m->pc);
+    insn = &m->icache[m->pc];
+    if(!insn->valid) predecode(insn, m->ir);
+    pc = m->pc++;
+    execute(m, insn);
+    m->retired++;
+    if((m->pc != pc+1) && (m->retired >= m->nextcheck)) checklimits(m);
+}
+
+/*
+ * startrun -- make a computer ready to run its program
+ *
+ * m -- the computer, with the program loaded into its memory or
+ * restored from a snapshot
+ *
+ * Installs the SIGSEGV handler, establishes the stack, and starts the
+ * profile, the resource limits and the I/O devices. The I/O devices
+ * run in buffered mode (see io.c) unless the computer's input or
+ * output is a terminal, or verbose mode or the --interactive command
+ * line option asks otherwise.
+ */
+void startrun(struct machine *m)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv;
+    sa.sa_flags = SA_SIGINFO|SA_NODEFER;
+    if(sigaction(SIGSEGV, &sa, 0)) die("cannot install signal handler");
+    running = m;
+
+    startstack(m);
+
+    if(profilefile) startprofile(m);
+    startlimits(m);
+    startio(m, !verbose && !interactive && !isatty(fileno(m->in)) && !isatty(fileno(m->out)));
+}
+
+/*
+ * simulate -- execute the program one CPU instruction at a time until HALT
+ *
+ * m -- the computer, with the program loaded into its memory or
+ * restored from a snapshot
+ *
+ * The program runs on the engine selected on the command line, see
+ * runcpu(), after startrun() has made the computer ready. If it spawns
+ * more CPUs, they are stopped and freed when it halts or error-exits.
+ */
+void simulate(struct machine *m)
+{
+    char msg[256], *error;
+    int status;
+
+    startrun(m);
+
+    if((error = catchdie(runcpuarg, m)))
+    {
+        snprintf(msg, sizeof(msg), "%s", error);
+        status = caughtstatus();
+        endcpus(m);
+        if(status == LIMITSTATUS) dielimit(msg);
+        die(msg);
     }
+    endcpus(m);
+    if(m->profile) endprofile(m, profilefile);
 }
@@ -2,4 +2,27 @@
  * and memory management are done in other modules, this one actually
  * simulates the CPU logic. */
 
-void simulate(void);
+/* Bitmasks for state register bits, for use with bitwise operations */
+#define SR_L 2 /* Whether last numerical comparison produced "less than" */
+#define SR_E 1 /* Whether last numerical comparison produced "equal to" */
+#define SR_G 0 /* Whether last numerical comparison produced "greater than" */
+
+/* Execution engines that can be selected on the command line */
+#define ENGINE_SWITCH   0 /* reference engine: a switch on the opcode */
+#define ENGINE_THREADED 1 /* direct-threaded engine, see threaded.c */
+#define ENGINE_JIT      2 /* native code translator, see jit.c */
+
+struct machine;
+struct dinsn;
+
+void badaddr(struct machine *m);
+void checklimits(struct machine *m);
+word_t getsr(struct machine *m);
+void execute(struct machine *m, struct dinsn *insn);
+void startstack(struct machine *m);
+void runcpu(struct machine *m);
+void runcpuarg(void *arg);
+void runturn(struct machine *m);
+void stepcpu(struct machine *m);
+void startrun(struct machine *m);
+void simulate(struct machine *m);
@@ -2,10 +2,27 @@
 
 #include <limits.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "size.h"
 #include "die.h"
 
+/* Whether the compiler has the type-generic overflow-checking
+ * arithmetic builtins of GCC 5 and Clang. Without them the checks are
+ * done with portable comparisons, which cost a division. */
+#ifndef HAVE_OVERFLOW_BUILTINS
+# if defined(__has_builtin)
+#  if __has_builtin(__builtin_mul_overflow)
+#   define HAVE_OVERFLOW_BUILTINS 1
+#  endif
+# elif defined(__GNUC__) && (__GNUC__ >= 5)
+#  define HAVE_OVERFLOW_BUILTINS 1
+# endif
+#endif
+#ifndef HAVE_OVERFLOW_BUILTINS
+# define HAVE_OVERFLOW_BUILTINS 0
+#endif
+
 /*
  * size_add -- add two size_t values, die on overflow
  *
@@ -23,37 +40,16 @@ size_t size_add(size_t a, size_t b)
  *
  * x and n -- operands
  * return value -- product
- *
- * Note that for "speed" the smaller value should be n, not x.
  */
 size_t size_mul(size_t x, size_t n)
 {
-    size_t c = 0;
-    for(; n; n--) c = size_add(c, x);
-    return(c);
-}
+#if HAVE_OVERFLOW_BUILTINS
+    size_t c;
 
-/*
- * size_shr -- _logical_ right-shift of a size_t value
- *
- * val -- the value to be shifted
- * nbits -- how many bits to shift by, modulo SIZE_BIT
- * return value -- the result
- */
-size_t size_shr(size_t val, size_t nbits)
-{
-    return((val>>nbits) & (SIZE_MAX>>(nbits&(SIZE_BIT-1))));
-}
-
-/*
- * size_sar -- _arithmetic_ right-shift of a size_t value
- *
- * val -- the value to be shifted
- * nbits -- how many bits to shift by, modulo SIZE_BIT
- * return value -- the result
- */
-size_t size_sar(size_t val, size_t nbits)
-{
-    if(!(val&((size_t)1<<(SIZE_BIT-1)))) return(size_shr(val, nbits));
-    return((val>>nbits) | ~(SIZE_MAX>>(nbits&(SIZE_BIT-1))));
+    if(__builtin_mul_overflow(x, n, &c)) die("integer overflow");
+    return(c);
+#else
+    if(n && (x > SIZE_MAX/n)) die("integer overflow");
+    return(x*n);
+#endif
 }
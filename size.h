@@ -12,5 +12,3 @@
 
 size_t size_add(size_t a, size_t b);
 size_t size_mul(size_t x, size_t n);
-size_t size_shr(size_t val, size_t nbits);
-size_t size_sar(size_t val, size_t nbits);
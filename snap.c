@@ -0,0 +1,187 @@
+/* Snapshots of a running computer. A snapshot holds everything needed
+ * to carry on running the program from where it was taken: the
+ * memory, the registers, the symbol table and how far the program had
+ * read its input devices. Restoring maps the memory from the snapshot
+ * file copy-on-write, so that restoring is cheap and any number of runs
+ * restored from one snapshot share the pages they don't write to.
+ *
+ * A snapshot file is a header, the symbol table as (offset, name
+ * offset) pairs followed by the null-terminated names, and, at an
+ * offset aligned to a page of the host that wrote it, an image of the
+ * accessible start of the memory region (see mem.c), which ends with
+ * the memory itself. The part of the image before the memory is left
+ * as a hole in the file. Numbers and words are in host byte order; the
+ * byte order mark and the word size tell whether the file was written
+ * on a compatible host. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "sym.h"
+#include "dev.h"
+#include "sim.h"
+#include "snap.h"
+
+/* The first bytes of every snapshot file */
+#define SNAPMAGIC "CKONESNP"
+
+/* Written as a 64-bit number after the magic */
+#define BYTEORDER 0x0102030405060708
+
+/* The version of the snapshot format written by writesnap() */
+#define SNAPVERSION 1
+
+/* The start of a snapshot file */
+struct snaphdr
+{
+    char magic[8];
+    uint64_t byteorder; /* BYTEORDER */
+    uint64_t version; /* SNAPVERSION */
+    uint64_t wordsize; /* size in bytes of a word, see word.h */
+    uint64_t memoff; /* offset in the file of the memory image */
+    uint64_t memmap; /* size in bytes of the memory image */
+    uint64_t memsize; /* size in words of the memory */
+    uint64_t codeoff, codesize, dataoff, datasize; /* the areas */
+    uint64_t regs[8]; /* general purpose registers */
+    uint64_t pc, ir, tr, sr, halted; /* control registers */
+    uint64_t retired; /* count of instructions executed */
+    uint64_t nsym; /* count of symbols */
+    uint64_t strsize; /* size in bytes of the symbol names */
+    uint64_t devpos[NPORTS]; /* positions of input devices, see devpos() */
+};
+
+/*
+ * roundpage -- round a size in bytes up to a whole number of pages
+ */
+static size_t roundpage(size_t n)
+{
+    size_t page;
+
+    page = sysconf(_SC_PAGESIZE);
+    return(size_mul(n/page + !!(n%page), page));
+}
+
+/*
+ * writesnap -- write a snapshot of a computer
+ *
+ * m -- the computer, between two instructions
+ * filename -- the name of the snapshot file to create
+ */
+void writesnap(struct machine *m, char *filename)
+{
+    struct snaphdr h;
+    uint64_t sym[2];
+    size_t i;
+    FILE *f;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPMAGIC, 8);
+    h.byteorder = BYTEORDER;
+    h.version = SNAPVERSION;
+    h.wordsize = sizeof(word_t);
+    h.memsize = m->memsize;
+    h.codeoff = m->codeoff;
+    h.codesize = m->codesize;
+    h.dataoff = m->dataoff;
+    h.datasize = m->datasize;
+    for(i=0; i<8; i++) h.regs[i] = m->regs[i];
+    h.pc = m->pc;
+    h.ir = m->ir;
+    h.tr = m->tr;
+    h.sr = getsr(m);
+    h.halted = m->halted;
+    h.retired = m->retired;
+    h.nsym = m->nsym;
+    for(i=0; i<m->nsym; i++) h.strsize = size_add(h.strsize, strlen(m->syms[i].sym)+1);
+    for(i=0; i<NPORTS; i++) h.devpos[i] = devpos(m, i);
+    h.memoff = roundpage(size_add(sizeof(h) + 16*h.nsym, h.strsize));
+    h.memmap = roundpage(size_mul(m->memsize, sizeof(word_t)));
+
+    if(!(f = fopen(filename, "wb"))) dies("cannot open snapshot file", filename);
+    fwrite(&h, sizeof(h), 1, f);
+    for(i=0, sym[1]=0; i<m->nsym; i++)
+    {
+        sym[0] = m->syms[i].off;
+        fwrite(sym, sizeof(sym[0]), 2, f);
+        sym[1] += strlen(m->syms[i].sym)+1;
+    }
+    for(i=0; i<m->nsym; i++) fwrite(m->syms[i].sym, 1, strlen(m->syms[i].sym)+1, f);
+    if(fseek(f, h.memoff + h.memmap - m->memsize*sizeof(word_t), SEEK_SET))
+        die("cannot write to snapshot file");
+    fwrite(m->mem, sizeof(word_t), m->memsize, f);
+    if(ferror(f)) die("cannot write to snapshot file");
+    if(fclose(f)) die("cannot close snapshot file");
+}
+
+/*
+ * loadsnap -- restore a computer from a snapshot
+ *
+ * m -- the computer, with nothing loaded but with its ports bound.
+ * Input devices that were read from files or word lists are moved to
+ * where the program had read them to; the console is not, since a
+ * restored run normally gets input of its own.
+ * filename -- the name of the snapshot file
+ */
+void loadsnap(struct machine *m, char *filename)
+{
+    struct snaphdr h;
+    struct stat st;
+    uint64_t *syms;
+    char *strs;
+    size_t i, n;
+    int fd;
+
+    if((fd = open(filename, O_RDONLY)) == -1) dies("cannot open snapshot file", filename);
+    if(fstat(fd, &st)) dies("cannot read from snapshot file", filename);
+    if((pread(fd, &h, sizeof(h), 0) != sizeof(h)) || memcmp(h.magic, SNAPMAGIC, 8))
+        dies("not a snapshot file:", filename);
+    if((h.byteorder != BYTEORDER) || (h.wordsize != sizeof(word_t)))
+        die("snapshot file from an incompatible host or word size");
+    if(h.version != SNAPVERSION) die("unsupported snapshot version");
+    if((h.nsym > SIZE_MAX/16) || (h.strsize > SIZE_MAX - 16*h.nsym)
+       || (h.memoff < sizeof(h) + 16*h.nsym + h.strsize)
+       || (h.memmap > SIZE_MAX - h.memoff) || ((uint64_t)st.st_size < h.memoff + h.memmap)
+       || (h.codeoff > h.memsize) || (h.codesize > h.memsize - h.codeoff)
+       || (h.dataoff > h.memsize) || (h.datasize > h.memsize - h.dataoff))
+        die("bad snapshot file");
+
+    n = 16*h.nsym + h.strsize;
+    if(!(syms = malloc(n ? n : 1))) die("out of memory");
+    if((size_t)pread(fd, syms, n, sizeof(h)) != n) die("cannot read from snapshot file");
+    strs = (char *)(syms + 2*h.nsym);
+    if(h.strsize && strs[h.strsize-1]) die("bad string table in snapshot");
+
+    mapmem(m, fd, h.memoff, h.memmap, h.memsize);
+    close(fd);
+    m->codeoff = h.codeoff;
+    m->codesize = h.codesize;
+    m->dataoff = h.dataoff;
+    m->datasize = h.datasize;
+    for(i=0; i<8; i++) m->regs[i] = h.regs[i];
+    m->pc = h.pc;
+    m->ir = h.ir;
+    m->tr = h.tr;
+    m->sr = h.sr;
+    m->halted = h.halted;
+    m->retired = h.retired;
+    m->started = 1;
+    for(i=0; i<h.nsym; i++)
+    {
+        if(syms[2*i+1] >= h.strsize) die("bad symbol name in snapshot");
+        addsym(m, strs + syms[2*i+1], syms[2*i]);
+    }
+    free(syms);
+    for(i=0; i<NPORTS; i++) setdevpos(m, i, h.devpos[i]);
+}
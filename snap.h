@@ -0,0 +1,8 @@
+/* Snapshots of a running computer. A snapshot holds everything needed
+ * to carry on running the program from where it was taken; restoring
+ * maps its memory copy-on-write. */
+
+struct machine;
+
+void writesnap(struct machine *m, char *filename);
+void loadsnap(struct machine *m, char *filename);
@@ -1,5 +1,7 @@
-/* Symbol table operations. */
+/* Symbol table operations. The symbol table is part of struct
+ * machine. */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,20 +9,35 @@
 
 #include "size.h"
 #include "die.h"
+#include "word.h"
+#include "machine.h"
 #include "mem.h"
+#include "sym.h"
 
-/* Symbol table entry */
-struct syment {
-    char *sym; /* Name of the symbol */
-    size_t off; /* Offset of its data word in the computer's word-addressable memory */
-};
-
-/* The symbol table, really just an array. Could be a tree or a
- * hash-table in a more demanding application. */
-static struct syment *syms;
+/* The symbol table, the syms member of struct machine, is an array of
+ * entries in the order they were added, nsym of them, with room for
+ * symcap. It is indexed two ways:
+ *
+ * symhash is an open-addressing hash table of symhashsize slots (a
+ * power of two), each holding the index of an entry plus one, or zero
+ * if the slot is empty. It is kept up to date by addsym().
+ *
+ * symbyaddr holds pointers to the entries sorted by address. It is
+ * only built when an address is first looked up, and thrown away by
+ * addsym(), since symbols are all added before the program runs. */
 
-/* Count of symbols currently in the symbol table. */
-static size_t nsym;
+/* The symbols that the assembler defines for the standard ports and
+ * supervisor calls. Their values are also addresses near the start of
+ * the program, but they are not labels. */
+static const struct
+{
+    const char *sym;
+    size_t off;
+} predefined[] =
+{
+    {"crt", 0}, {"kbd", 1}, {"stdin", 6}, {"stdout", 7},
+    {"halt", 11}, {"read", 12}, {"write", 13}, {"time", 14}, {"date", 15},
+};
 
 /*
  * xstrdup -- copy a C string in memory or die if out of memory
@@ -39,41 +56,245 @@ static char *xstrdup(char *src)
     return(dst);
 }
 
+/*
+ * hashsym -- compute the hash value of a symbol name (FNV-1a)
+ *
+ * sym -- the name
+ * return value -- the hash value
+ */
+static size_t hashsym(const char *sym)
+{
+    size_t h;
+
+    h = 2166136261u;
+    for(; *sym; sym++) h = (h ^ (unsigned char)*sym) * 16777619u;
+    return(h);
+}
+
+/*
+ * findslot -- find the hash table slot of a symbol name
+ *
+ * m -- the computer
+ * sym -- the name
+ * return value -- the index of the slot holding the symbol, or of the
+ * empty slot where it would go
+ *
+ * The hash table must have at least one empty slot.
+ */
+static size_t findslot(struct machine *m, const char *sym)
+{
+    size_t mask, i;
+
+    mask = m->symhashsize-1;
+    for(i=hashsym(sym) & mask; m->symhash[i]; i=(i+1) & mask)
+        if(!strcmp(m->syms[m->symhash[i]-1].sym, sym)) break;
+    return(i);
+}
+
+/*
+ * rehash -- grow the hash table and put the symbols back in it
+ *
+ * m -- the computer
+ */
+static void rehash(struct machine *m)
+{
+    size_t i, slot;
+
+    free(m->symhash);
+    m->symhashsize = m->symhashsize ? size_mul(m->symhashsize, 2) : 64;
+    if(!(m->symhash = calloc(m->symhashsize, sizeof(size_t)))) die("out of memory");
+    for(i=0; i<m->nsym; i++)
+        if(!m->symhash[slot = findslot(m, m->syms[i].sym)]) m->symhash[slot] = i+1;
+}
+
 /*
  * addsym -- add a symbol to the symbol table
  *
+ * m -- the computer
  * sym -- the name of the new symbol
  * off -- the offset of the symbol's data word in the computer's memory
  *
- * Doesn't check for duplicates. Dies if out of memory.
+ * Doesn't check for duplicates; lookups by name find the first symbol
+ * added with the name. Dies if out of memory.
+ */
+void addsym(struct machine *m, char *sym, size_t off)
+{
+    size_t slot;
+
+    if(m->nsym == m->symcap)
+    {
+        m->symcap = m->symcap ? size_mul(m->symcap, 2) : 16;
+        m->syms = realloc(m->syms, size_mul(m->symcap, sizeof(struct syment)));
+        if(!m->syms) die("out of memory");
+    }
+    m->syms[m->nsym].sym = xstrdup(sym);
+    m->syms[m->nsym].off = off;
+    m->nsym++;
+
+    /* Keep the hash table at most half full */
+    if(size_mul(m->nsym, 2) > m->symhashsize) rehash(m);
+    else if(!m->symhash[slot = findslot(m, sym)]) m->symhash[slot] = m->nsym;
+
+    free(m->symbyaddr);
+    m->symbyaddr = 0;
+}
+
+/*
+ * findsym -- look up a symbol by name
+ *
+ * m -- the computer
+ * sym -- the name
+ * return value -- the symbol table entry, or a null pointer if there
+ * is no symbol with the name
+ */
+struct syment *findsym(struct machine *m, char *sym)
+{
+    size_t slot;
+
+    if(!m->nsym) return(0);
+    slot = findslot(m, sym);
+    return(m->symhash[slot] ? &m->syms[m->symhash[slot]-1] : 0);
+}
+
+/*
+ * cmpaddr -- qsort() comparison function ordering symbol table entries
+ * by address, and those with the same address in the order they were
+ * added
+ */
+static int cmpaddr(const void *a, const void *b)
+{
+    const struct syment *x = *(struct syment *const *)a;
+    const struct syment *y = *(struct syment *const *)b;
+
+    if(x->off != y->off) return((x->off < y->off) ? -1 : 1);
+    return((x < y) ? -1 : (x > y));
+}
+
+/*
+ * ispredefined -- tell whether a symbol is one of those the assembler
+ * defines for ports and supervisor calls, with its usual value
+ */
+int ispredefined(struct syment *ent)
+{
+    size_t i;
+
+    for(i=0; i<sizeof(predefined)/sizeof(predefined[0]); i++)
+        if((ent->off == predefined[i].off) && !strcmp(ent->sym, predefined[i].sym)) return(1);
+    return(0);
+}
+
+/*
+ * above -- find the first symbol above an address in the index by
+ * address, building the index if need be
+ *
+ * m -- the computer, with at least one symbol
+ * addr -- the address
+ * return value -- the position in symbyaddr of the first entry with
+ * an address greater than addr, or nsym if there is none
+ */
+static size_t above(struct machine *m, size_t addr)
+{
+    size_t lo, hi, mid, i;
+
+    if(!m->symbyaddr)
+    {
+        m->symbyaddr = malloc(size_mul(m->nsym, sizeof(struct syment *)));
+        if(!m->symbyaddr) die("out of memory");
+        for(i=0; i<m->nsym; i++) m->symbyaddr[i] = &m->syms[i];
+        qsort(m->symbyaddr, m->nsym, sizeof(struct syment *), cmpaddr);
+    }
+    lo = 0;
+    hi = m->nsym;
+    while(lo < hi)
+    {
+        mid = lo + (hi-lo)/2;
+        if(m->symbyaddr[mid]->off <= addr) lo = mid+1; else hi = mid;
+    }
+    return(lo);
+}
+
+/*
+ * nearestsym -- look up the symbol closest to an address from below
+ *
+ * m -- the computer
+ * addr -- the address
+ * return value -- the entry of the symbol with the largest address
+ * not greater than addr (the first one added, if there are several),
+ * or a null pointer if every symbol lies above addr
+ */
+struct syment *nearestsym(struct machine *m, size_t addr)
+{
+    size_t i;
+
+    if(!m->nsym || !(i = above(m, addr))) return(0);
+
+    /* Back up to the first entry with the same address */
+    for(i--; i && (m->symbyaddr[i-1]->off == m->symbyaddr[i]->off); i--);
+    return(m->symbyaddr[i]);
+}
+
+/*
+ * nearestlabel -- look up the label closest to an address from below
+ *
+ * m -- the computer
+ * addr -- the address
+ * return value -- as for nearestsym(), but leaving out the symbols
+ * for which ispredefined() is true
  */
-void addsym(char *sym, size_t off)
+struct syment *nearestlabel(struct machine *m, size_t addr)
 {
-    syms = realloc(syms, size_mul(size_add(nsym, 1), sizeof(struct syment)));
-    if(!syms) die("out of memory");
-    syms[nsym].sym = xstrdup(sym);
-    syms[nsym].off = off;
-    nsym++;
+    size_t i, best;
+
+    if(!m->nsym) return(0);
+    for(i=above(m, addr); i && ispredefined(m->symbyaddr[i-1]); i--);
+    if(!i) return(0);
+
+    /* Back up to the first such entry with the same address */
+    for(best=--i; i && (m->symbyaddr[i-1]->off == m->symbyaddr[best]->off); i--)
+        if(!ispredefined(m->symbyaddr[i-1])) best = i-1;
+    return(m->symbyaddr[best]);
 }
 
 /*
  * printsymtab -- write the symbol table to standard output
  *
+ * m -- the computer
+ *
  * Writes the data word of each symbol whose data word lies in the
  * data area of the computer's memory.
  */
-void printsymtab(void)
+void printsymtab(struct machine *m)
 {
     struct syment *ent;
-    size_t val;
+    word_t val;
 
-    for(ent=syms; ent<syms+nsym; ent++)
+    for(ent=m->syms; ent<m->syms+m->nsym; ent++)
     {
-        if((ent->off >= dataoff) && (ent->off < dataoff+datasize))
+        if((ent->off >= m->dataoff) && (ent->off < m->dataoff+m->datasize))
         {
-            val = getmem(ent->off);
+            val = getmem(m, ent->off);
             printf("%s(0x%zx) == 0x%zx (decimal %zd)\n",
-                   ent->sym, ent->off, val, (ssize_t)val);
+                   ent->sym, ent->off, (size_t)val, (ssize_t)(sword_t)val);
         }
     }
 }
+
+/*
+ * freesyms -- empty the symbol table, releasing its memory
+ *
+ * m -- the computer
+ */
+void freesyms(struct machine *m)
+{
+    size_t i;
+
+    for(i=0; i<m->nsym; i++) free(m->syms[i].sym);
+    free(m->syms);
+    free(m->symhash);
+    free(m->symbyaddr);
+    m->syms = 0;
+    m->nsym = m->symcap = 0;
+    m->symhash = 0;
+    m->symhashsize = 0;
+    m->symbyaddr = 0;
+}
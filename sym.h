@@ -1,4 +1,18 @@
-/* Symbol table operations. */
+/* Symbol table operations. The symbol table is part of struct
+ * machine. */
 
-void addsym(char *sym, size_t off);
-void printsymtab(void);
+/* Symbol table entry */
+struct syment {
+    char *sym; /* Name of the symbol */
+    size_t off; /* Offset of its data word in the computer's word-addressable memory */
+};
+
+struct machine;
+
+void addsym(struct machine *m, char *sym, size_t off);
+struct syment *findsym(struct machine *m, char *sym);
+struct syment *nearestsym(struct machine *m, size_t addr);
+struct syment *nearestlabel(struct machine *m, size_t addr);
+int ispredefined(struct syment *ent);
+void printsymtab(struct machine *m);
+void freesyms(struct machine *m);
@@ -0,0 +1,78 @@
+#!/bin/sh
+# JIT code buffer regression test. Builds programs made of blocks of
+# the longest length the JIT translates, each filled with the
+# instruction whose translation is longest, and runs them often enough
+# that every block is translated. The translated code is larger than
+# the code buffer, so the buffer fills up and is flushed. A shorter
+# block at the start shifts where the blocks fall in the buffer; one
+# program is made for each length of it, so that some block ends up
+# right before the end of the buffer. Each program must behave the same
+# under the JIT as under the switch engine.
+#
+# usage: test/jitblock.sh
+
+ckone=${CKONE:-./ckone}
+dir=${TMPDIR:-/tmp}/ckone-jitblock-test.$$
+
+trap 'rm -rf "$dir"' EXIT INT TERM
+mkdir "$dir" || exit 1
+
+# gen kind pad -- write a program whose blocks consist of 63
+# instructions of the given kind followed by a JUMP to the next block,
+# after a first block of pad such instructions:
+#   store -- STORE R1, @D(R2)
+#   push -- PUSH SP, @D(R2) and POP SP, R4 in turn
+gen() {
+    awk -v kind="$1" -v pad="$2" '
+    function insn(op, r, mode, idx, imm) {
+        print op*16777216 + r*2097152 + mode*524288 + idx*65536 + imm
+    }
+    function body(n) {
+        for(i=0; i<n; i++)
+            if(kind == "store") insn(1, 1, 2, 2, d)       # STORE R1, @D(R2)
+            else if(i%2) insn(52, 6, 0, 4, 0)             # POP SP, R4
+            else insn(51, 6, 2, 2, d)                     # PUSH SP, @D(R2)
+    }
+    BEGIN {
+        nblock = 420; passes = 20
+        loop = 2; first = loop + pad + 1; code = first + nblock*64 + 4; d = code
+        print "___b91___"; print "___code___"; print 0, code-1
+        insn(2, 3, 0, 0, passes)            # LOAD R3, =passes
+        insn(2, 5, 0, 6, 0)                 # LOAD R5, 0(SP)
+        body(pad)
+        insn(32, 0, 0, 0, first)            # JUMP first
+        for(b=0; b<nblock; b++)
+        {
+            body(63)
+            insn(32, 0, 0, 0, first + (b+1)*64)    # JUMP next
+        }
+        insn(2, 6, 0, 5, 0)                 # LOAD SP, 0(R5)
+        insn(18, 3, 0, 0, 1)                # SUB R3, =1
+        insn(35, 3, 0, 0, loop)             # JPOS R3, loop
+        insn(112, 6, 0, 0, 11)              # SVC SP, =HALT
+        print "___data___"; print d, d+2
+        print d+1; print d+2; print 0
+        print "___symboltable___"; print "halt 11"; print "___end___"
+    }' > "$dir/prog.b91"
+}
+
+status=0
+for kind in store push; do
+    failed=0
+    pad=0
+    while [ $pad -lt 64 ]; do
+        gen $kind $pad
+        "$ckone" --engine switch "$dir/prog.b91" > "$dir/switch" 2>&1
+        echo "exit $?" >> "$dir/switch"
+        "$ckone" --engine jit "$dir/prog.b91" > "$dir/jit" 2>&1
+        echo "exit $?" >> "$dir/jit"
+        if ! cmp -s "$dir/switch" "$dir/jit"; then
+            echo "$kind, first block of $pad: FAILED"
+            diff "$dir/switch" "$dir/jit"
+            failed=1
+        fi
+        pad=$((pad + 1))
+    done
+    if [ $failed = 0 ]; then echo "$kind: ok"; else status=1; fi
+done
+exit $status
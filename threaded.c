@@ -0,0 +1,453 @@
+/* Direct-threaded execution engine. Rather than switching on the
+ * opcode of every instruction like simulate() does, this engine gives
+ * each entry of the instruction cache the address of a handler that
+ * is specialized for both its opcode and its operand form, and every
+ * handler ends by jumping straight to the handler of the next
+ * instruction. So the common instructions are executed without any
+ * run-time test of the opcode or the addressing mode.
+ *
+ * The handlers are labels inside a single function, whose addresses
+ * are taken with the "labels as values" extension of GNU C. With
+ * other compilers the engine is not available.
+ *
+ * Rarely executed instructions (I/O, supervisor calls, PUSHR/POPR and
+ * invalid opcodes) are handed over to execute() in the simulator
+ * module, so their semantics are defined in one place only. The
+ * instruction register is only kept up to date for them.
+ *
+ * Some sequences of instructions that compilers emit over and over are
+ * fused into superinstructions: when the first instruction of such a
+ * sequence in the code area is decoded, it gets a handler that executes
+ * the whole sequence in one dispatch. The rest of the sequence keeps
+ * its own cache entries, for jumps into the middle of it, and they are
+ * marked as covered so that overwriting them also invalidates the
+ * fused handler. The fused sequences are
+ *
+ *   LOAD Ri, x / ADD Ri, =k / STORE Ri, a  (and the same with SUB)
+ *   COMP Ri, x / JLES, JEQU, JGRE, JNLES, JNEQU or JNGRE a
+ *   PUSH SP, x / PUSH SP, y / CALL SP, a
+ *
+ * where the registers need not be the same, and only x and y may use
+ * other addressing modes than the ones shown. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "mem.h"
+#include "reg.h"
+#include "insn.h"
+#include "icache.h"
+#include "ckone.h"
+#include "sim.h"
+#include "threaded.h"
+
+#ifdef __GNUC__
+
+/* Number of operand forms each opcode has a handler for. The form of
+ * an instruction is its addressing mode times two, plus one if it has
+ * an index register. Mode 3 behaves like mode 0 in the reference
+ * engine, so it uses the same handlers. */
+#define NFORMS 6
+
+/* The operand form of a pre-decoded instruction */
+#define FORM(d) (((d)->mode == 3 ? 0 : (d)->mode) * 2 + !!(d)->idxreg)
+
+/* Fused instruction sequences, see the top of this file */
+#define FUSE_NONE     0
+#define FUSE_LOADADD  1 /* LOAD Ri, x / ADD Ri, =k / STORE Ri, a */
+#define FUSE_LOADSUB  2 /* LOAD Ri, x / SUB Ri, =k / STORE Ri, a */
+#define FUSE_COMPJUMP 3 /* COMP Ri, x / conditional jump on the state register */
+#define FUSE_CALL     4 /* PUSH SP, x / PUSH SP, y / CALL SP, a */
+#define NFUSE 5
+
+/* The state register bit tested by each of the jumps JLES to JNGRE */
+static const word_t jumpbits[6] =
+{
+    1<<SR_L, 1<<SR_E, 1<<SR_G, 1<<SR_L, 1<<SR_E, 1<<SR_G
+};
+
+/* Wrappers for the GNU C extensions, marked as such so that -pedantic
+ * doesn't complain about them. */
+#define LABEL(l) (__extension__ &&l)
+#define GOTO(p) __extension__ ({ goto *(p); })
+
+/*
+ * fault -- die because of an invalid memory address
+ *
+ * m -- the computer
+ * p -- the engine's program counter
+ * return value -- none, but declared to return a word so it can be
+ * used inside expressions
+ *
+ * The engine checks addresses itself instead of relying on the memory
+ * faulting, because the signal handler could not see its program
+ * counter, which lives in a local variable.
+ */
+static word_t fault(struct machine *m, size_t p)
+{
+    m->pc = p;
+    badaddr(m);
+    return(0);
+}
+
+/*
+ * limit -- check the resource limits at the end of a basic block
+ *
+ * m -- the computer
+ * p -- the engine's program counter
+ * c -- the engine's count of instructions retired
+ * return value -- when to check again
+ */
+static size_t limit(struct machine *m, size_t p, size_t c)
+{
+    m->pc = p;
+    m->retired = c;
+    checklimits(m);
+    return(m->nextcheck);
+}
+
+/*
+ * fusible -- find out whether an instruction starts a sequence that can
+ * be fused
+ *
+ * m -- the computer
+ * p -- the address of the instruction, whose cache entry is decoded
+ * return value -- one of the FUSE_* constants
+ *
+ * Only sequences entirely inside the code area are fused. If the
+ * sequence is fusible, the rest of it is marked as covered.
+ */
+static int fusible(struct machine *m, size_t p)
+{
+    struct dinsn *d = &m->icache[p];
+    size_t len, i;
+    int f;
+
+    if((p < m->codeoff) || (p-m->codeoff >= m->codesize)) return(FUSE_NONE);
+    if((d->opcode != 0x02) && (d->opcode != 0x1F) && (d->opcode != 0x33)) return(FUSE_NONE);
+    len = (d->opcode == 0x1F) ? 2 : 3;
+    if(m->codesize - (p-m->codeoff) < len) return(FUSE_NONE);
+
+    /* Decode the rest of the sequence for the fused handler to use,
+     * but leave the entries invalid, so that they still take the cache
+     * miss path when jumped to and may start fused sequences of their
+     * own */
+    for(i=1; i<len; i++)
+    {
+        if(d[i].valid) continue;
+        predecode(&d[i], m->mem[p+i]);
+        d[i].valid = 0;
+    }
+
+    if((d->opcode == 0x02) && ((d[1].opcode == 0x11) || (d[1].opcode == 0x12)) && !FORM(&d[1])
+       && (d[2].opcode == 0x01) && !FORM(&d[2]))
+        f = (d[1].opcode == 0x11) ? FUSE_LOADADD : FUSE_LOADSUB;
+    else if((d->opcode == 0x1F) && (d[1].opcode >= 0x27) && (d[1].opcode <= 0x2C) && !FORM(&d[1]))
+        f = FUSE_COMPJUMP;
+    else if((d->opcode == 0x33) && (d[1].opcode == 0x33) && (d[2].opcode == 0x31) && !FORM(&d[2]))
+        f = FUSE_CALL;
+    else
+        return(FUSE_NONE);
+
+    for(i=1; i<len; i++)
+        if(d[i].covered < i) d[i].covered = i;
+    return(f);
+}
+
+/*
+ * simulate_threaded -- execute the program until HALT using the
+ * direct-threaded engine
+ *
+ * m -- the computer
+ *
+ * The caller has already established the stack.
+ */
+void simulate_threaded(struct machine *m)
+{
+    void *handlers[256][NFORMS];
+    void *fused[NFUSE][NFORMS]; /* handlers of fused sequences */
+    struct dinsn *d, *ic;
+    word_t *words;
+    unsigned char *dirty; /* the dirty page map, see mem.h */
+    size_t msize;
+    word_t r[8]; /* general purpose registers */
+    size_t p; /* program counter */
+    word_t t; /* temporary register */
+    word_t s; /* state register */
+    size_t a; /* scratch address */
+    size_t n; /* count of words to pop in EXIT */
+    size_t c; /* count of instructions retired */
+    size_t lim; /* value of c at which to check the resource limits */
+    size_t f; /* count of instructions executed by fused handlers */
+    size_t i;
+
+    /* Fill the handler table. Opcodes without a handler of their own
+     * go through execute(). */
+    for(i=0; i<256; i++)
+        for(a=0; a<NFORMS; a++)
+            handlers[i][a] = LABEL(slow);
+#define SETFORMS(h, name) \
+    h[0] = LABEL(name##0); \
+    h[1] = LABEL(name##1); \
+    h[2] = LABEL(name##2); \
+    h[3] = LABEL(name##3); \
+    h[4] = LABEL(name##4); \
+    h[5] = LABEL(name##5)
+#define SET(op, name) SETFORMS(handlers[op], name)
+    SET(0x00, nop);
+    SET(0x01, store);
+    SET(0x02, load);
+    SET(0x11, add);
+    SET(0x12, sub);
+    SET(0x13, mul);
+    SET(0x14, div);
+    SET(0x15, mod);
+    SET(0x16, and);
+    SET(0x17, or);
+    SET(0x18, xor);
+    SET(0x19, shl);
+    SET(0x1A, shr);
+    SET(0x1B, shra);
+    SET(0x1F, comp);
+    SET(0x20, jump);
+    SET(0x21, jneg);
+    SET(0x22, jzer);
+    SET(0x23, jpos);
+    SET(0x24, jnneg);
+    SET(0x25, jnzer);
+    SET(0x26, jnpos);
+    SET(0x27, jles);
+    SET(0x28, jequ);
+    SET(0x29, jgre);
+    SET(0x2A, jnles);
+    SET(0x2B, jnequ);
+    SET(0x2C, jngre);
+    SET(0x31, call);
+    SET(0x32, exit);
+    SET(0x33, push);
+    SET(0x34, pop);
+#undef SET
+    SETFORMS(fused[FUSE_LOADADD], loadadd);
+    SETFORMS(fused[FUSE_LOADSUB], loadsub);
+    SETFORMS(fused[FUSE_COMPJUMP], compjump);
+    SETFORMS(fused[FUSE_CALL], pushcall);
+#undef SETFORMS
+
+    /* Entries may have been decoded without a handler, so start from
+     * an empty cache. */
+    icache_flush(m);
+
+    /* Keep the machine state in local variables, which the compiler
+     * knows cannot alias the memory array. */
+#define LOADSTATE() \
+    (ic = m->icache, words = m->mem, dirty = m->dirty, msize = m->memsize, p = m->pc, \
+     s = getsr(m), c = m->retired, lim = m->nextcheck, f = m->fused, \
+     memcpy(r, m->regs, sizeof(r)))
+#define SAVESTATE() \
+    (m->pc = p, m->sr = s, m->retired = c, m->fused = f, memcpy(m->regs, r, sizeof(r)))
+    LOADSTATE();
+
+    /* Memory access. Stores mark their page dirty and invalidate the
+     * instruction cache entry of the word they overwrite. */
+#define LD(x) ((a = (x)) < msize ? words[a] : fault(m, p))
+#define ST(x, w) \
+    do { \
+        if((a = (x)) >= msize) fault(m, p); \
+        words[a] = (w); \
+        dirty[a >> PAGESHIFT] = 1; \
+        ICACHE_INVALIDATE(ic, a); \
+    } while(0)
+
+    /* Stack operations, like push() and pop() in sim.c */
+#define PUSH(sp, w) do { r[sp]++; ST(r[sp], (w)); } while(0)
+#define POP(sp) (t = LD(r[sp]), r[sp]--, t)
+
+    /* Control transfer. An out-of-range target is reported right away
+     * since it has no instruction cache entry to dispatch through.
+     * Taken transfers end basic blocks, which is where the resource
+     * limits are checked. */
+#define JUMPTO(x) \
+    ((p = (x)) < msize ? (void)0 : (void)fault(m, p), \
+     c < lim ? (void)0 : (void)(lim = limit(m, p, c)))
+
+    /* Dispatch to the handler of the instruction at p */
+#define NEXT \
+    do { \
+        d = &ic[p]; \
+        if(!d->valid) goto miss; \
+        p++; \
+        c++; \
+        GOTO(d->handler); \
+    } while(0)
+
+    /* Operand fetch for each operand form */
+#define OPERAND0 t = d->imm
+#define OPERAND1 t = d->imm + r[d->idxreg]
+#define OPERAND2 t = LD(d->imm)
+#define OPERAND3 t = LD(d->imm + r[d->idxreg])
+#define OPERAND4 t = LD(LD(d->imm))
+#define OPERAND5 t = LD(LD(d->imm + r[d->idxreg]))
+
+    /* Operand fetch for an instruction e of any operand form, for the
+     * later instructions of fused sequences */
+#define OPERAND(e) \
+    (t = (e)->imm + ((e)->idxreg ? r[(e)->idxreg] : 0), \
+     t = ((e)->mode == 1) ? LD(t) : ((e)->mode == 2) ? LD(LD(t)) : t)
+
+    /* Set the comparison bits of the state register from comparing
+     * register x with t */
+#define COMPARE(x) \
+    (s = (s & ~(word_t)((1<<SR_L) | (1<<SR_E) | (1<<SR_G))) \
+       | ((word_t)WORD_LT((x), t) << SR_L) \
+       | ((word_t)((x) == t) << SR_E) \
+       | ((word_t)WORD_LT(t, (x)) << SR_G))
+
+    /* Move on to the next instruction of a fused sequence */
+#define STEP (p++, c++, f++)
+
+    /* Define the handlers of one opcode, one for each operand form.
+     * body executes the instruction d with its operand in t. */
+#define HANDLER(name, body) \
+    name##0: OPERAND0; body; NEXT; \
+    name##1: OPERAND1; body; NEXT; \
+    name##2: OPERAND2; body; NEXT; \
+    name##3: OPERAND3; body; NEXT; \
+    name##4: OPERAND4; body; NEXT; \
+    name##5: OPERAND5; body; NEXT
+
+    NEXT;
+
+    HANDLER(nop, (void)t);
+    HANDLER(store, ST(t, r[d->reg]));
+    HANDLER(load, r[d->reg] = t);
+    HANDLER(add, r[d->reg] += t);
+    HANDLER(sub, r[d->reg] -= t);
+    HANDLER(mul, r[d->reg] *= t);
+    HANDLER(div, r[d->reg] = word_div(r[d->reg], t));
+    HANDLER(mod, r[d->reg] = word_mod(r[d->reg], t));
+    HANDLER(and, r[d->reg] &= t);
+    HANDLER(or, r[d->reg] |= t);
+    HANDLER(xor, r[d->reg] ^= t);
+    HANDLER(shl, r[d->reg] = word_shl(r[d->reg], t));
+    HANDLER(shr, r[d->reg] = word_shr(r[d->reg], t));
+    HANDLER(shra, r[d->reg] = word_sar(r[d->reg], t));
+    HANDLER(comp, COMPARE(r[d->reg]));
+    HANDLER(jump, JUMPTO(t));
+    HANDLER(jneg, if((sword_t)r[d->reg] < 0) JUMPTO(t));
+    HANDLER(jzer, if((sword_t)r[d->reg] == 0) JUMPTO(t));
+    HANDLER(jpos, if((sword_t)r[d->reg] > 0) JUMPTO(t));
+    HANDLER(jnneg, if((sword_t)r[d->reg] >= 0) JUMPTO(t));
+    HANDLER(jnzer, if((sword_t)r[d->reg] != 0) JUMPTO(t));
+    HANDLER(jnpos, if((sword_t)r[d->reg] <= 0) JUMPTO(t));
+    HANDLER(jles, if(s & (1<<SR_L)) JUMPTO(t));
+    HANDLER(jequ, if(s & (1<<SR_E)) JUMPTO(t));
+    HANDLER(jgre, if(s & (1<<SR_G)) JUMPTO(t));
+    HANDLER(jnles, if(!(s & (1<<SR_L))) JUMPTO(t));
+    HANDLER(jnequ, if(!(s & (1<<SR_E))) JUMPTO(t));
+    HANDLER(jngre, if(!(s & (1<<SR_G))) JUMPTO(t));
+    HANDLER(call,
+            PUSH(d->reg, p);
+            PUSH(d->reg, r[FP]);
+            r[FP] = r[SP];
+            JUMPTO(t));
+    HANDLER(exit,
+            n = t;
+            r[FP] = POP(d->reg);
+            a = POP(d->reg);
+            JUMPTO(a);
+            for(; n; n--) (void)POP(d->reg));
+    HANDLER(push, PUSH(d->reg, t));
+    HANDLER(pop, r[d->idxreg] = POP(d->reg));
+
+    /* Handlers of fused sequences, one for each operand form of the
+     * first instruction. The entries of the later instructions follow
+     * the first one's. A sequence whose first instruction has been
+     * overwritten or whose later instructions have been is finished
+     * one instruction at a time. */
+    HANDLER(loadadd,
+            f++;
+            r[d->reg] = t;
+            STEP;
+            r[d[1].reg] += d[1].imm;
+            STEP;
+            ST(d[2].imm, r[d[2].reg]));
+    HANDLER(loadsub,
+            f++;
+            r[d->reg] = t;
+            STEP;
+            r[d[1].reg] -= d[1].imm;
+            STEP;
+            ST(d[2].imm, r[d[2].reg]));
+    HANDLER(compjump,
+            f++;
+            COMPARE(r[d->reg]);
+            STEP;
+            if(!(s & jumpbits[d[1].opcode - 0x27]) == (d[1].opcode >= 0x2A)) JUMPTO(d[1].imm));
+    HANDLER(pushcall,
+            f++;
+            PUSH(d->reg, t);
+            if(!d->valid) NEXT;
+            STEP;
+            OPERAND(&d[1]);
+            PUSH(d[1].reg, t);
+            if(!d->valid) NEXT;
+            STEP;
+            PUSH(d[2].reg, p);
+            PUSH(d[2].reg, r[FP]);
+            r[FP] = r[SP];
+            JUMPTO(d[2].imm));
+
+    /* Instructions without a handler of their own */
+slow:
+    m->ir = words[p-1];
+    SAVESTATE();
+    /* Like simulate(), count the instruction only once it is executed,
+     * so that I/O happens at the same count in every engine */
+    m->retired--;
+    execute(m, d);
+    m->retired++;
+    if(m->halted) return;
+    LOADSTATE();
+    NEXT;
+
+    /* Instruction cache miss: decode the instruction and pick its
+     * handler */
+miss:
+    if(p >= msize) fault(m, p);
+    predecode(d, words[p]);
+    d->handler = handlers[d->opcode][FORM(d)];
+    if(fuse && (i = fusible(m, p))) d->handler = fused[i][FORM(d)];
+    NEXT;
+}
+
+#else
+
+/*
+ * simulate_threaded -- stub for compilers without labels as values
+ */
+void simulate_threaded(struct machine *m)
+{
+    die("threaded engine not supported by this compiler");
+}
+
+#endif
+
+/*
+ * printfusion -- report how many of the instructions executed were
+ * executed by fused handlers
+ *
+ * m -- the computer, after running the program
+ * f -- the stream to write the report to
+ */
+void printfusion(struct machine *m, FILE *f)
+{
+    fprintf(f, "fused %zu of %zu instructions executed (%.1f%%)\n", m->fused, m->retired,
+            m->retired ? 100.0 * m->fused / m->retired : 0.0);
+}
@@ -0,0 +1,8 @@
+/* Direct-threaded execution engine. Runs the program just like
+ * simulate() does, only faster. <stdio.h> must be included before this
+ * header. */
+
+struct machine;
+
+void simulate_threaded(struct machine *m);
+void printfusion(struct machine *m, FILE *f);
@@ -0,0 +1,223 @@
+/* Execution trace. Records every instruction the simulator executes,
+ * with its effect, into a ring buffer that holds the most recent ones
+ * and is written to a binary file when the run ends, and decodes such
+ * files for reading.
+ *
+ * Recording an instruction costs a few stores into the ring buffer,
+ * so tracing a long run is limited by the simulator rather than by
+ * stdio. Decoding, which goes through the disassembler, is done
+ * offline by ckone --dump-trace.
+ *
+ * A trace file is the magic "CKONETRC", a byte order mark, the count
+ * of instructions executed and the count of records in the file, all
+ * 64-bit numbers, followed by the records from the oldest to the
+ * newest. Numbers are in host byte order; the byte order mark tells
+ * whether the file was written on a compatible host. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "size.h"
+#include "die.h"
+#include "word.h"
+#include "machine.h"
+#include "reg.h"
+#include "sym.h"
+#include "disasm.h"
+#include "trace.h"
+
+/* The first bytes of every trace file */
+#define TRACEMAGIC "CKONETRC"
+
+/* Written as a 64-bit number after the magic */
+#define BYTEORDER 0x0102030405060708
+
+/* Bits of the flags of a record */
+#define REGMASK 0x0f /* number of the register written, or NOREG */
+#define WROTE 0x10 /* the instruction wrote to memory */
+
+/* Register number meaning that no register was written */
+#define NOREG 8
+
+/* What an executed instruction did */
+struct tracerec
+{
+    uint64_t pc; /* its address */
+    uint64_t ir; /* the instruction word */
+    uint64_t regval; /* new value of the last register written, sign-extended */
+    uint64_t addr; /* address of the last memory word written */
+    uint64_t word; /* value written there, sign-extended */
+    uint32_t flags; /* see above */
+};
+
+/* A ring buffer of records */
+struct trace
+{
+    struct tracerec *recs;
+    size_t size; /* room for records, a power of two */
+    size_t count; /* instructions recorded since the start */
+    char *filename; /* where to write the records */
+};
+
+/* The computer whose trace is to be written if the process exits
+ * before the run ends */
+static struct machine *tracing;
+
+/*
+ * writetrace -- write the records of a computer's trace to its file
+ *
+ * m -- the computer
+ */
+static void writetrace(struct machine *m)
+{
+    struct trace *t = m->trace;
+    uint64_t hdr[3];
+    size_t n, first;
+    FILE *f;
+
+    if(!(f = fopen(t->filename, "wb"))) dies("cannot open trace file", t->filename);
+    n = (t->count < t->size) ? t->count : t->size;
+    first = (t->count - n) & (t->size-1);
+    hdr[0] = BYTEORDER;
+    hdr[1] = t->count;
+    hdr[2] = n;
+    fwrite(TRACEMAGIC, 1, 8, f);
+    fwrite(hdr, sizeof(hdr[0]), 3, f);
+    if(first+n > t->size)
+    {
+        fwrite(t->recs+first, sizeof(struct tracerec), t->size-first, f);
+        fwrite(t->recs, sizeof(struct tracerec), first+n-t->size, f);
+    }
+    else fwrite(t->recs+first, sizeof(struct tracerec), n, f);
+    if(ferror(f)) die("cannot write to trace file");
+    if(fclose(f)) die("cannot close trace file");
+}
+
+/*
+ * writeatexit -- atexit() handler writing the trace of a run that
+ * ended in an error-exit, which is when the trace is needed the most
+ */
+static void writeatexit(void)
+{
+    struct machine *m = tracing;
+
+    /* Don't come back here if writing dies */
+    tracing = 0;
+    if(m) writetrace(m);
+}
+
+/*
+ * starttrace -- start recording the instructions a computer executes
+ *
+ * m -- the computer
+ * filename -- the name of the file to write the trace to
+ * size -- how many of the most recent instructions to keep; rounded
+ * up to a power of two
+ *
+ * Tracing is done by the reference engine, see simulate(). The trace
+ * is written by endtrace(), or when the process exits if that is never
+ * called. Only one computer can be traced at a time.
+ */
+void starttrace(struct machine *m, char *filename, size_t size)
+{
+    static int registered;
+    struct trace *t;
+
+    if(!(t = calloc(1, sizeof(*t)))) die("out of memory");
+    for(t->size = 1; t->size < size; t->size = size_mul(t->size, 2));
+    if(!(t->recs = calloc(t->size, sizeof(struct tracerec)))) die("out of memory");
+    t->filename = filename;
+    m->trace = t;
+    tracing = m;
+    if(!registered && atexit(writeatexit)) die("cannot register trace writer");
+    registered = 1;
+}
+
+/*
+ * recordtrace -- record an instruction just executed
+ *
+ * m -- the computer
+ * pc -- the address of the instruction. Its word is still in the
+ * instruction register.
+ *
+ * Before executing the instruction, the caller sets lastreg to NOREG
+ * (8) and lastwrite to SIZE_MAX; setreg() and setmem() update them.
+ */
+void recordtrace(struct machine *m, size_t pc)
+{
+    struct trace *t = m->trace;
+    struct tracerec *r;
+    uint32_t flags;
+
+    r = &t->recs[t->count++ & (t->size-1)];
+    r->pc = pc;
+    r->ir = m->ir;
+    flags = m->lastreg;
+    if(flags != NOREG) r->regval = (sword_t)m->regs[flags];
+    if(m->lastwrite != SIZE_MAX)
+    {
+        flags |= WROTE;
+        r->addr = m->lastwrite;
+        r->word = (sword_t)m->mem[m->lastwrite];
+    }
+    r->flags = flags;
+}
+
+/*
+ * endtrace -- stop recording and write the trace to its file
+ *
+ * m -- the computer
+ */
+void endtrace(struct machine *m)
+{
+    if(!m->trace) return;
+    if(tracing == m) tracing = 0;
+    writetrace(m);
+    free(m->trace->recs);
+    free(m->trace);
+    m->trace = 0;
+}
+
+/*
+ * dumptrace -- print a trace file in readable form
+ *
+ * m -- a computer with the traced program loaded, for its symbols, or
+ * with nothing loaded
+ * filename -- the name of the trace file
+ *
+ * Each instruction is disassembled from the word that was executed,
+ * followed by the last register and the last memory word it wrote,
+ * if any.
+ */
+void dumptrace(struct machine *m, char *filename)
+{
+    struct tracerec r;
+    uint64_t hdr[3];
+    char magic[8];
+    size_t i;
+    FILE *f;
+
+    if(!(f = fopen(filename, "rb"))) dies("cannot open trace file", filename);
+    if((fread(magic, 1, 8, f) != 8) || memcmp(magic, TRACEMAGIC, 8)) die("not a trace file");
+    if(fread(hdr, sizeof(hdr[0]), 3, f) != 3) die("truncated trace file");
+    if(hdr[0] != BYTEORDER) die("trace file from a host with different byte order");
+    if(hdr[1] > hdr[2])
+        fprintf(m->out, "(%llu earlier instructions not recorded)\n",
+                (unsigned long long)(hdr[1]-hdr[2]));
+    for(i=0; i<hdr[2]; i++)
+    {
+        if(fread(&r, sizeof(r), 1, f) != 1) die("truncated trace file");
+        disasmword(m, r.pc, r.ir);
+        if((r.flags & REGMASK) < NOREG)
+            fprintf(m->out, "\t%s=%zd", regnames[r.flags & REGMASK], (ssize_t)r.regval);
+        if(r.flags & WROTE)
+            fprintf(m->out, "\t[%zu]=%zd", (size_t)r.addr, (ssize_t)r.word);
+        fprintf(m->out, "\n");
+    }
+    if(ferror(f)) die("cannot read from trace file");
+    fclose(f);
+    fflush(m->out);
+}
@@ -0,0 +1,11 @@
+/* Execution trace. Records every instruction the simulator executes,
+ * with its effect, into a ring buffer that holds the most recent ones
+ * and is written to a binary file when the run ends, and decodes such
+ * files for reading. */
+
+struct machine;
+
+void starttrace(struct machine *m, char *filename, size_t size);
+void recordtrace(struct machine *m, size_t pc);
+void endtrace(struct machine *m);
+void dumptrace(struct machine *m, char *filename);
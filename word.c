@@ -0,0 +1,104 @@
+/* TTK-91 words. The words of a TTK-91 computer are 32 bits wide, and
+ * so are those of the simulated computer, unless ckone is built with
+ * WORDBITS=64 (see the Makefile), in which case they are as wide as a
+ * host size_t as in older versions of ckone. This module implements
+ * the arithmetic on words that C leaves undefined or implementation
+ * defined: shifts by the word width or more, right shifts of negative
+ * numbers, and division.
+ *
+ * Shift counts are taken modulo the word width, like Titokone and the
+ * host's shift instructions do. With 32-bit words, DIV and MOD divide
+ * signed integers, rounding towards zero; with 64-bit words they
+ * divide unsigned ones as in older versions of ckone. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "die.h"
+#include "word.h"
+
+/* All bits of a word set */
+#define WORD_MAX ((word_t)-1)
+
+/* The sign bit of a word */
+#define WORD_SIGN ((word_t)1 << (WORDBITS-1))
+
+/*
+ * word_shl -- left-shift a word
+ *
+ * val -- the word to be shifted
+ * nbits -- how many bits to shift by, modulo WORDBITS
+ * return value -- the result
+ */
+word_t word_shl(word_t val, word_t nbits)
+{
+    return(val << (nbits & (WORDBITS-1)));
+}
+
+/*
+ * word_shr -- _logical_ right-shift of a word
+ *
+ * val -- the word to be shifted
+ * nbits -- how many bits to shift by, modulo WORDBITS
+ * return value -- the result
+ */
+word_t word_shr(word_t val, word_t nbits)
+{
+    return(val >> (nbits & (WORDBITS-1)));
+}
+
+/*
+ * word_sar -- _arithmetic_ right-shift of a word
+ *
+ * val -- the word to be shifted
+ * nbits -- how many bits to shift by, modulo WORDBITS
+ * return value -- the result
+ */
+word_t word_sar(word_t val, word_t nbits)
+{
+    nbits &= WORDBITS-1;
+    if(!(val & WORD_SIGN)) return(val >> nbits);
+    return((val >> nbits) | ~(WORD_MAX >> nbits));
+}
+
+/*
+ * word_div -- divide two words as DIV does
+ *
+ * a -- the dividend
+ * b -- the divisor
+ * return value -- the quotient
+ *
+ * Dies if the divisor is zero. Dividing the most negative word by -1
+ * gives the most negative word.
+ */
+word_t word_div(word_t a, word_t b)
+{
+    if(!b) die("division by zero");
+#if WORDBITS == 32
+    if((a == WORD_SIGN) && (b == WORD_MAX)) return(a);
+    return((word_t)((sword_t)a / (sword_t)b));
+#else
+    return(a / b);
+#endif
+}
+
+/*
+ * word_mod -- take the remainder of dividing two words as MOD does
+ *
+ * a -- the dividend
+ * b -- the divisor
+ * return value -- the remainder, which has the sign of the dividend
+ *
+ * Dies if the divisor is zero.
+ */
+word_t word_mod(word_t a, word_t b)
+{
+    if(!b) die("division by zero");
+#if WORDBITS == 32
+    if(b == WORD_MAX) return(0);
+    return((word_t)((sword_t)a % (sword_t)b));
+#else
+    return(a % b);
+#endif
+}
@@ -0,0 +1,36 @@
+/* TTK-91 words. The words of a TTK-91 computer are 32 bits wide, and
+ * so are those of the simulated computer, unless ckone is built with
+ * WORDBITS=64 (see the Makefile), in which case they are as wide as a
+ * host size_t as in older versions of ckone. Words are kept unsigned,
+ * so that arithmetic on them wraps around, and are converted to
+ * sword_t wherever they are taken as signed integers. <stdint.h> and
+ * <unistd.h> must be included before this header. */
+
+#ifndef WORDBITS
+#define WORDBITS 32
+#endif
+
+#if WORDBITS == 32
+typedef uint32_t word_t;
+typedef int32_t sword_t;
+#elif WORDBITS == 64
+typedef size_t word_t;
+typedef ssize_t sword_t;
+#else
+#error "WORDBITS must be 32 or 64"
+#endif
+
+/* Whether word a is less than word b as COMP compares them: as signed
+ * integers like TTK-91 does, except with 64-bit words, which compare
+ * as unsigned integers like in older versions of ckone. */
+#if WORDBITS == 32
+#define WORD_LT(a, b) ((sword_t)(a) < (sword_t)(b))
+#else
+#define WORD_LT(a, b) ((word_t)(a) < (word_t)(b))
+#endif
+
+word_t word_shl(word_t val, word_t nbits);
+word_t word_shr(word_t val, word_t nbits);
+word_t word_sar(word_t val, word_t nbits);
+word_t word_div(word_t a, word_t b);
+word_t word_mod(word_t a, word_t b);